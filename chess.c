@@ -20,6 +20,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -28,6 +30,17 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <unistd.h>
 #include <termios.h>
 #include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86
+#endif
 
 #define BOARD_SIZE 8
 
@@ -39,52 +52,287 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define PLAYER_1 'X'
 #define PLAYER_2 'O'
 
-// Keyhandler logic.
+// Terminal settings from before the game, put back on exit or on a fatal signal.
+struct termios originalTerminal;
+bool rawModeEnabled = false;
+
+// Keys read from the terminal but not handled yet.
+struct inputQueue
+{
+    char bytes[256];
+    int start;
+    int end;
+};
+
+struct inputQueue pendingInput;
+
+// Put the terminal back the way it was found, and show the cursor again.
+void restoreTerminal(void) {
+    if (!rawModeEnabled) return;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &originalTerminal);
+    if (write(STDOUT_FILENO, "\e[0m\e[?25h\n", 11) < 0) {
+        // Nothing more can be done for the terminal.
+    }
+    rawModeEnabled = false;
+}
+
+// Restore the terminal before a signal ends the game, then let the signal take its usual course.
+void terminalSignal(int signalNumber) {
+    restoreTerminal();
+    signal(signalNumber, SIG_DFL);
+    raise(signalNumber);
+}
+
+// Switch the terminal to unbuffered, unechoed input for the whole game, rather than once per key.
+void enableRawMode(void) {
+    if (tcgetattr(STDIN_FILENO, &originalTerminal) < 0) return;
+
+    struct termios raw = originalTerminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0) return;
+
+    rawModeEnabled = true;
+    atexit(restoreTerminal);
+    signal(SIGINT, terminalSignal);
+    signal(SIGTERM, terminalSignal);
+    signal(SIGHUP, terminalSignal);
+    signal(SIGQUIT, terminalSignal);
+}
+
+// Wait up to the given milliseconds (-1 for ever) for input, then read everything that has arrived.
+// Returns false if nothing came.
+bool readInput(int timeout) {
+    struct inputQueue* queue = &pendingInput;
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+
+    if (queue->start == queue->end) {
+        queue->start = 0;
+        queue->end = 0;
+    }
+
+    bool received = false;
+    while (queue->end < (int)sizeof(queue->bytes) && poll(&input, 1, received ? 0 : timeout) > 0) {
+        ssize_t count = read(STDIN_FILENO, &queue->bytes[queue->end], sizeof(queue->bytes) - queue->end);
+        if (count <= 0) break;
+        queue->end += count;
+        received = true;
+    }
+
+    return received;
+}
+
+// Check if there are keys waiting to be handled, without blocking.
+bool keysPending(void) {
+    return pendingInput.start != pendingInput.end || readInput(0);
+}
+
+// Take the next byte of input, waiting up to the given milliseconds (-1 for ever). Returns 0 if none came.
+char nextInputByte(int timeout) {
+    struct inputQueue* queue = &pendingInput;
+
+    if (queue->start == queue->end && !readInput(timeout)) {
+        return 0;
+    }
+    return queue->bytes[queue->start++];
+}
+
+// Keyhandler logic. Arrow keys arrive as escape sequences, and are turned into the ijkl keys they stand for.
 char getch(void)
 {
-    char buf = 0;
-    struct termios old = {0};
-    fflush(stdout);
-    if(tcgetattr(0, &old) < 0)
-        perror("tcsetattr()");
-    old.c_lflag &= ~ICANON;
-    old.c_lflag &= ~ECHO;
-    old.c_cc[VMIN] = 1;
-    old.c_cc[VTIME] = 0;
-    if(tcsetattr(0, TCSANOW, &old) < 0)
-        perror("tcsetattr ICANON");
-    if(read(0, &buf, 1) < 0)
-        perror("read()");
-    old.c_lflag |= ICANON;
-    old.c_lflag |= ECHO;
-    if(tcsetattr(0, TCSADRAIN, &old) < 0)
-        perror("tcsetattr ~ICANON");
-    return buf;
-}
-
-// Necessary game data.
+    char key = nextInputByte(-1);
+    if (key != '\e') return key;
+
+    // A lone escape key has nothing following it.
+    char introducer = nextInputByte(25);
+    if (introducer != '[' && introducer != 'O') return introducer;
+
+    switch(nextInputByte(25)) {
+        case 'A':
+            return 'i';
+        case 'B':
+            return 'k';
+        case 'C':
+            return 'l';
+        case 'D':
+            return 'j';
+        default:
+            return 0;
+    }
+}
+
+// Piece colours, used to index the bitboards.
+#define WHITE 0
+#define BLACK 1
+
+// Piece types, used to index the bitboards.
+#define PAWN 0
+#define KNIGHT 1
+#define BISHOP 2
+#define ROOK 3
+#define QUEEN 4
+#define KING 5
+
+#define NO_PIECE -1
+
+// What each piece code is, looked up by the code itself. Colour and type are stored one higher, so the
+// zeroes left for every character that isn't a piece read back as NO_PIECE.
+struct pieceInfo
+{
+    int8_t color;
+    int8_t type;
+};
+
+const struct pieceInfo pieceTable[256] = {
+    ['P'] = {WHITE + 1, PAWN + 1},
+    ['N'] = {WHITE + 1, KNIGHT + 1},
+    ['B'] = {WHITE + 1, BISHOP + 1},
+    ['R'] = {WHITE + 1, ROOK + 1},
+    ['Q'] = {WHITE + 1, QUEEN + 1},
+    ['K'] = {WHITE + 1, KING + 1},
+    ['p'] = {BLACK + 1, PAWN + 1},
+    ['n'] = {BLACK + 1, KNIGHT + 1},
+    ['b'] = {BLACK + 1, BISHOP + 1},
+    ['r'] = {BLACK + 1, ROOK + 1},
+    ['q'] = {BLACK + 1, QUEEN + 1},
+    ['k'] = {BLACK + 1, KING + 1}
+};
+
+// The glyph drawn for each piece code, or NULL for a corrupt one.
+const char* const pieceSymbols[256] = {
+    ['P'] = "♟", ['N'] = "♞", ['B'] = "♝", ['R'] = "♜", ['Q'] = "♛", ['K'] = "♚",
+    ['p'] = "♙", ['n'] = "♘", ['b'] = "♗", ['r'] = "♖", ['q'] = "♕", ['k'] = "♔",
+    ['0'] = " "
+};
+
+// Bit for a square, where squares are numbered y * BOARD_SIZE + x (a8 is 0, h1 is 63).
+#define SQUARE_BIT(square) (1ULL << (square))
+
+// The longest game that can be played and taken back on one board, including search lines.
+#define MAX_GAME_PLY 2048
+
+// Width of the optional neural network's first layer, which every board keeps up to date for both sides.
+#define NNUE_HIDDEN 256
+
+// Everything makeMove overwrites that unmakeMove cannot work out from the move itself.
+struct undoRecord
+{
+    uint16_t move;
+    char piece;
+    char captured;
+    uint8_t castleRights;
+    int8_t enPassant;
+    int8_t kingSquare[2];
+    uint16_t halfmoveClock;
+    uint16_t reversiblePlies;
+};
+
+// The game board. The grid keeps the character codes the rules are written against,
+// and every change to it is mirrored into per-piece and per-colour 64-bit masks,
+// the squares attacked by the piece on each square, and each side's attacked squares.
+// The rest of the position and the stack of moves played on it sit alongside.
+struct chessBoard
+{
+    char grid[BOARD_SIZE * BOARD_SIZE];
+    uint64_t pieces[2][6];
+    uint64_t colors[2];
+    uint64_t occupied;
+    uint64_t attacks[BOARD_SIZE * BOARD_SIZE];
+    uint64_t attackMaps[2];
+    bool attackMapsStale;
+    int side;
+    int castleRights;
+    int enPassant; // Square of the pawn that can be taken En Passant, or OFF_BOARD.
+    int kingSquare[2];
+    uint64_t key; // Zobrist key of the position.
+    uint64_t pawnKey; // Zobrist key of the pawns alone, for the pawn structure table.
+    int score; // Material and piece-square score for White, middlegame and endgame packed together by S().
+    int phase; // Sum of the phase weights of the pieces on the board.
+    int16_t accumulator[2][NNUE_HIDDEN]; // First layer of the neural network from each side's point of view, when one is loaded.
+    bool accumulatorStale[2]; // Set when a side's king has moved, so its accumulator has to be rebuilt.
+    int accumulatorVersion; // The networkVersion the accumulators were built for.
+    int halfmoveClock; // Plies since the last capture or pawn move.
+    int reversiblePlies; // Plies since the last capture, pawn move or lost castling right: as far back as a position can repeat.
+    int startPly; // Plies played before the board was set up, counting from White's first move.
+    int historyCount;
+    struct undoRecord history[MAX_GAME_PLY];
+    uint64_t keyHistory[MAX_GAME_PLY]; // Key of the position before each move on the stack, kept apart so repetition scans stay compact.
+};
+
+// A position packed small enough to copy around freely and to keep a great many of, with none of the board's
+// bitboards or move stack. Squares take four bits each, White's pawn to king as 1 to 6 and Black's as 9 to 14.
+struct position
+{
+    uint8_t squares[BOARD_SIZE * BOARD_SIZE / 2];
+    uint16_t ply; // Plies played since White's first move.
+    uint16_t halfmoveClock;
+    uint8_t side;
+    uint8_t castleRights;
+    int8_t enPassant;
+    int8_t kingSquare[2];
+};
+
+// A position has to fit in a cache line.
+typedef char positionSizeCheck[(sizeof(struct position) <= 64) ? 1 : -1];
+
+// How the computer searches: its budget for each move, the size of its table, its threads and
+// which of the SEARCH_ selectivity techniques it uses. A depth or move time of 0 leaves that budget unlimited.
+// On a clock, the budget is worked out from the time left, the increment and the moves to the next time control.
+struct engineOptions
+{
+    int depth;
+    double moveTime;
+    int hashMegabytes;
+    int threads;
+    bool pinThreads;
+    int features;
+    double clock; // Seconds left on the computer's clock, or 0 when it plays without one.
+    double increment;
+    int movesToGo; // 0 when the clock has to last the rest of the game.
+};
+
+// Most threads the engine will search or run perft on.
+#define MAX_THREADS 256
+
+struct highlightCache;
+
+// What the player at the terminal is doing, kept apart from the game itself.
+struct uiState
+{
+    int cursorX;
+    int cursorY;
+    bool selectMode;
+    int selectedX;
+    int selectedY;
+    char selectedPiece;
+};
+
+// A game as it is kept in a pool between moves: its packed position, the player's cursor and selection,
+// and who the computer plays.
+struct storedGame
+{
+    struct position position;
+    struct uiState ui;
+    char computerPlayer; // The player the engine moves for, or '.' for two humans.
+    int nextFree; // Index of the next unused game while this one is unused, otherwise -1.
+};
+
+// Necessary game data. Castling rights, king squares and checks are read straight off the board, which is
+// only the working copy of the stored game's position while it is being played.
 struct gameState 
 {
-    char* board;
+    struct chessBoard* board;
     char currentPlayer;
     char lastPlayer;
     int turnCount;
-    int cursorX;
-    int cursorY;
-    int* selectMode;
-    int* selectedX;
-    int* selectedY;
-    char selectedPiece;
-    int* queensideCastleWhite;
-    int* queensideCastleBlack;
-    int* kingsideCastleWhite;
-    int* kingsideCastleBlack;
-    int* kingWhiteX;
-    int* kingWhiteY;
-    int* kingBlackX;
-    int* kingBlackY;
-    int* whiteCheck;
-    int* blackCheck;
+    struct storedGame* game;
+    uint16_t* redoMoves;
+    int redoCount;
+    struct engineOptions engine;
+    struct transpositionTable* table;
+    struct pawnTable* pawns; // One per engine thread, or NULL.
+    struct highlightCache* highlights;
 };
 
 // Swap two characters, essential for alternating the checkerboard pattern.
@@ -94,739 +342,1145 @@ void swapChar(char* a, char* b) {
     *b = temp;
 }
 
-// Set the current item in a given board position.
-void setGridItem(char* board, int x, int y, char item) {
-    *(board + y * BOARD_SIZE + x) = item; 
+// Check if the given position is within board bounds.
+bool validBoardPosition(int x, int y) {
+    return ((x >= 0 && x < BOARD_SIZE) && (y >= 0 && y < BOARD_SIZE));
 }
 
-// Show the current item in a given board position.
-char getGridItem(char* board, int x, int y) {
-    return *(board + y * BOARD_SIZE + x);
+// Get the bitboard colour of a character piece.
+int pieceColor(char piece) {
+    return pieceTable[(unsigned char)piece].color - 1;
 }
 
-// Check if a given board position is an empty space.
-bool isEmpty(char* board, int x, int y) {
-    return (getGridItem(board, x, y) == '0');
+// Get the bitboard type of a character piece. Special pawn states are all pawns.
+int pieceType(char piece) {
+    return pieceTable[(unsigned char)piece].type - 1;
 }
 
-// Check if the given position is within board bounds.
-bool validBoardPosition(int x, int y) {
-    return ((x >= 0 && x < BOARD_SIZE) && (y >= 0 && y < BOARD_SIZE));
+// Show the current item in a given board position. Off-board reads are reported as corrupt.
+char getGridItem(struct chessBoard* board, int x, int y) {
+    if (!validBoardPosition(x, y)) return '.';
+    return board->grid[y * BOARD_SIZE + x];
 }
 
-// Get the string value of the piece we want to display.
-char* getSymbol(char* board, int x, int y) {
-    switch(getGridItem(board, x, y)) {
-        // Regular Pieces
-        case 'p': // Pawn Black
-            return "♙";
-        case 'P': // Pawn White
-            return "♟";
-        case 'b': // Bishop Black
-            return "♗";
-        case 'B': // Bishop White 
-            return "♝";
-        case 'r': // Rook Black
-            return "♖";
-        case 'R': // Rook White 
-            return "♜";
-        case 'n': // Knight Black
-            return "♘";
-        case 'N': // Knight White 
-            return "♞";
-        case 'k': // King Black
-            return "♔";
-        case 'K': // King White 
-            return "♚";
-        case 'q': // Queen Black
-            return "♕";
-        case 'Q': // Queen White 
-            return "♛";
-        case 'E': // Double-Step Pawn White
-            return "♟";
-        case 'e': // Double-Step Pawn Black
-            return "♙";
-        case 'A': // En Passant White
-            return "♟";
-        case 'a': // En Passant Black
-            return "♙";
-        case '0': // Empty Space
-            return " ";
-        default: // Corrupt
-            return ".";
-    }
+// Check if a given board position is an empty space.
+bool isEmpty(struct chessBoard* board, int x, int y) {
+    return (getGridItem(board, x, y) == '0');
 }
 
-// Check if the given target character is an enemy.
-bool checkNotFriendlyTarget(char t, char positionPiece) {
-    switch(positionPiece) {
-        case 'p': // Pawn Black
-        case 'b': // Bishop Black
-        case 'r': // Rook Black
-        case 'n': // Knight Black
-        case 'k': // King Black
-        case 'q': // Queen Black
-        case 'e': // Double Step Pawn
-        case 'a': // En Passant Pawn
-            if (t == 'p' || t == 'b' || t == 'r' || t == 'n' 
-                || t == 'k' || t == 'q' || t == 'e' || t == 'a') {
-                    return true;
-            }
-            else {
-                return false;
-            }
-            break;
-        case 'P': // Pawn White
-        case 'B': // Bishop White
-        case 'R': // Rook White
-        case 'N': // Knight White
-        case 'K': // King White
-        case 'Q': // Queen White
-        case 'E': // Double Step Pawn
-        case 'A': // En Passant Pawn
-            if (t == 'P' || t == 'B' || t == 'R' || t == 'N' 
-                || t == 'K' || t == 'Q' || t == 'E' || t == 'A') {
-                    return true;
-            }
-            else {
-                return false;
-            }
-            break;
-        default:
-            return false;
-    }
+// Get the string value of the piece we want to display.
+const char* getSymbol(struct chessBoard* board, int x, int y) {
+    const char* symbol = pieceSymbols[(unsigned char)getGridItem(board, x, y)];
+    return symbol ? symbol : "."; // Corrupt
 }
 
-// Check if the piece selected is the current player's.
-int whosePiece(char player) {
-    switch(player) {
-        case 'p': // Pawn Black
-        case 'b': // Bishop Black
-        case 'r': // Rook Black
-        case 'n': // Knight Black
-        case 'k': // King Black
-        case 'q': // Queen Black
-        case 'e': // Double Step Pawn Black
-        case 'a': // En Passant Pawn Black
-            if ('O' == player) return true;
-        case 'P': // Pawn White
-        case 'B': // Bishop White
-        case 'R': // Rook White
-        case 'N': // Knight White
-        case 'K': // King White
-        case 'Q': // Queen White
-        case 'E': // Double Step Pawn White
-        case 'A': // En Passant Pawn White
-            if ('X' == player) return true;
-        default:
-            return '.';
-    }
+// Check if the given target character is a piece of the same colour as the one on the position.
+bool checkNotFriendlyTarget(char t, char positionPiece) {
+    int color = pieceTable[(unsigned char)positionPiece].color;
+    return color != 0 && color == pieceTable[(unsigned char)t].color;
 }
 
 // Get the player character given a character piece.
 char whoseTurn(char piece) {
-    switch(piece) {
-        case 'p': // Pawn Black
-        case 'b': // Bishop Black
-        case 'r': // Rook Black
-        case 'n': // Knight Black
-        case 'k': // King Black
-        case 'q': // Queen Black
-        case 'e': // Double Step Pawn Black
-        case 'a': // En Passant Pawn Black
-            return 'O';
-        case 'P': // Pawn White
-        case 'B': // Bishop White
-        case 'R': // Rook White
-        case 'N': // Knight White
-        case 'K': // King White
-        case 'Q': // Queen White
-        case 'E': // Double Step Pawn White
-        case 'A': // En Passant Pawn White
-            return 'X';
-        default:
-            return '.';
-    }
+    const char players[3] = {'.', PLAYER_1, PLAYER_2};
+    return players[pieceTable[(unsigned char)piece].color];
 }
 
-// Helper function necessary for testing where movement for the bishop, rook and queen should stop.
-int testCollision(char* board, int positionX, int positionY, int offsetX, int offsetY) {
-    int testX = positionX + offsetX;
-    int testY = positionY + offsetY;
+// Precomputed attack tables for the pieces that jump, indexed by square.
+uint64_t knightAttacks[BOARD_SIZE * BOARD_SIZE];
+uint64_t kingAttacks[BOARD_SIZE * BOARD_SIZE];
+uint64_t pawnAttacks[2][BOARD_SIZE * BOARD_SIZE];
+
+// Magic bitboard entry for a sliding piece on one square.
+struct magicEntry
+{
+    uint64_t mask;
+    uint64_t magic;
+    uint64_t* attacks;
+    int shift;
+};
 
-    int i = 0;
+struct magicEntry bishopMagics[BOARD_SIZE * BOARD_SIZE];
+struct magicEntry rookMagics[BOARD_SIZE * BOARD_SIZE];
 
-    bool collision = isEmpty(board, testX, testY);
+// Shared attack storage for every occupancy of every square.
+uint64_t bishopTable[5248];
+uint64_t rookTable[102400];
 
-    while(collision && validBoardPosition(testX, testY)) {
-        i++;     
-        testX = positionX + (i * offsetX);
-        testY = positionY + (i * offsetY);
-        
-        collision = isEmpty(board, testX, testY);
-    }
+const int bishopDirections[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+const int rookDirections[4][2] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}};
 
-    // Debug collision detection.
-    // printf("%d", i);
-    return i;
-}
+// Walk the rays from a square until they leave the board or hit a piece, used to fill the slider tables.
+uint64_t slidingAttacks(int square, uint64_t occupied, const int directions[4][2]) {
+    uint64_t attacks = 0;
 
-// Collision detection for the Bishop piece for diagonal movement.
-bool bishopMove(char* board, int targetX, int targetY, int positionX, int positionY) {
-    int bounds;
-    int offsetX;
-    int offsetY;
-    
-    if (targetX > positionX) {
-        // South East Direction
-        if (targetY > positionY) {
-            bounds = testCollision(board, positionX, positionY, 1, 1);
-            offsetX = 1;
-            offsetY = 1;
-        }
-        // North East Direction
-        else {
-            bounds = testCollision(board, positionX, positionY, 1, -1);
-            offsetX = 1;
-            offsetY = -1;
+    for (int i = 0; i < 4; i++) {
+        int x = square % BOARD_SIZE + directions[i][0];
+        int y = square / BOARD_SIZE + directions[i][1];
+
+        while (validBoardPosition(x, y)) {
+            attacks |= SQUARE_BIT(y * BOARD_SIZE + x);
+            if (occupied & SQUARE_BIT(y * BOARD_SIZE + x)) break;
+            x += directions[i][0];
+            y += directions[i][1];
         }
     }
-    // North West Direction
-    else if (targetY > positionY) {
-        bounds = testCollision(board, positionX, positionY, -1, 1);
-        offsetX = -1;
-        offsetY = 1;
-    }
-    // South West Direction
-    else {
-        bounds = testCollision(board, positionX, positionY, -1, -1);
-        offsetX = -1;
-        offsetY = -1;
-    }
 
-    // If the offset falls within the given bounds, allow movement there.
-    for (int i = 1; i < bounds; i++) {
-        int testX = positionX + (offsetX * i);
-        int testY = positionY + (offsetY * i);
-        bool locationMatch = (testX == targetX) && (testY == targetY);
-        
-        if (locationMatch) return true;
+    return attacks;
+}
+
+// Magic multipliers, found offline by a random search against the masks built in initMagics().
+const uint64_t bishopMagicNumbers[BOARD_SIZE * BOARD_SIZE] = {
+    0x10102002004A1420ULL, 0x8020040400584008ULL, 0x10510800811201C8ULL, 0x5204042080000088ULL,
+    0x2204106880000002ULL, 0x1401042004000000ULL, 0x0400880410042004ULL, 0x0028208200A02020ULL,
+    0x1500241990010E00ULL, 0x8001200182020A40ULL, 0x40004101030B0000ULL, 0x8002041042000100ULL,
+    0x4010011041020038ULL, 0x0000010421044000ULL, 0x1500210808020A00ULL, 0x8000088400880520ULL,
+    0x0405004010040100ULL, 0x1005823210040108ULL, 0x2708008102040011ULL, 0x4048200404009100ULL,
+    0x0018104101400024ULL, 0x0003000601190101ULL, 0x8004803108491000ULL, 0x8014241200820800ULL,
+    0x0006E080100C3040ULL, 0x0501044A11041800ULL, 0x9020300008004045ULL, 0x0894080000220040ULL,
+    0x1001010083104000ULL, 0x5004030040900080ULL, 0x000400422C012400ULL, 0x0002128698404812ULL,
+    0x1010108404900440ULL, 0x0928021182084100ULL, 0x2006080409020024ULL, 0x1010202020180080ULL,
+    0xA010008200202200ULL, 0x2098015100019004ULL, 0x0002041440810811ULL, 0x802A02020000B098ULL,
+    0x0009015090004060ULL, 0x4000821082081001ULL, 0x0100210040420800ULL, 0x0800004010488A00ULL,
+    0x2000081104004040ULL, 0x4C8E029015000082ULL, 0x0420340322224842ULL, 0x1298260043400210ULL,
+    0x0000822802400008ULL, 0x00008A0101600000ULL, 0x3040003412080021ULL, 0x3040290220884800ULL,
+    0x4A1500401041004AULL, 0x8010200282020781ULL, 0x0020203142209091ULL, 0x0070300600902110ULL,
+    0x0040808800B62048ULL, 0x0000810400C44420ULL, 0x00080400440C0441ULL, 0x8340080020840411ULL,
+    0x0000000104208200ULL, 0x0000800810D00080ULL, 0x0400530411080200ULL, 0x4040702400932244ULL
+};
+
+const uint64_t rookMagicNumbers[BOARD_SIZE * BOARD_SIZE] = {
+    0x1080004008801020ULL, 0x0840092002C03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+    0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+    0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+    0x000A001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+    0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021D00100ULL,
+    0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000A0001768104ULL,
+    0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+    0x0442000A00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040A00128541ULL,
+    0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+    0x0400802402800800ULL, 0xC100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+    0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000A0020ULL,
+    0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+    0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040A00300ULL, 0x0801100280080480ULL,
+    0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+    0x0000209300488001ULL, 0x04C1002414824001ULL, 0x020020000B001041ULL, 0x7000100004200901ULL,
+    0x8002002004100802ULL, 0x30010002084C0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL
+};
+
+// Fill each square's slice of the attack table, indexed by its magic multiplier.
+void initMagics(struct magicEntry* magics, uint64_t* table, const uint64_t* magicNumbers, const int directions[4][2]) {
+    uint64_t* next = table;
+
+    for (int square = 0; square < BOARD_SIZE * BOARD_SIZE; square++) {
+        struct magicEntry* entry = &magics[square];
+        int x = square % BOARD_SIZE;
+        int y = square / BOARD_SIZE;
+
+        // The last square of each ray never blocks anything, so leave the edges out of the mask.
+        uint64_t edges = 0;
+        if (y != 0) edges |= 0xFFULL;
+        if (y != 7) edges |= 0xFFULL << 56;
+        if (x != 0) edges |= 0x0101010101010101ULL;
+        if (x != 7) edges |= 0x8080808080808080ULL;
+
+        entry->mask = slidingAttacks(square, 0, directions) & ~edges;
+        entry->magic = magicNumbers[square];
+        entry->shift = 64 - __builtin_popcountll(entry->mask);
+        entry->attacks = next;
+
+        // Enumerate every subset of the mask and store its attack set.
+        uint64_t subset = 0;
+        do {
+            entry->attacks[(subset * entry->magic) >> entry->shift] = slidingAttacks(square, subset, directions);
+            subset = (subset - entry->mask) & entry->mask;
+        } while (subset);
+
+        next += SQUARE_BIT(64 - entry->shift);
     }
+}
 
-    return false;
+// Squares a bishop on the given square attacks, including the first blocker on each ray.
+uint64_t bishopAttacks(int square, uint64_t occupied) {
+    struct magicEntry* entry = &bishopMagics[square];
+    return entry->attacks[((occupied & entry->mask) * entry->magic) >> entry->shift];
 }
 
-// Collision detection for the Rook piece for vertical and horizontal movement.
-bool rookMove(char* board, int targetX, int targetY, int positionX, int positionY) {
-    int bounds;
-    int offsetX;
-    int offsetY;
-
-    if (targetX == positionX) {
-        // South
-        if (targetY > positionY) {
-            bounds = testCollision(board, positionX, positionY, 0, 1);
-            offsetX = 0;
-            offsetY = 1;
-        }
-        // North
-        else {
-            bounds = testCollision(board, positionX, positionY, 0, -1);
-            offsetX = 0;
-            offsetY = -1;
+// Squares a rook on the given square attacks, including the first blocker on each ray.
+uint64_t rookAttacks(int square, uint64_t occupied) {
+    struct magicEntry* entry = &rookMagics[square];
+    return entry->attacks[((occupied & entry->mask) * entry->magic) >> entry->shift];
+}
+
+// Squares a queen on the given square attacks.
+uint64_t queenAttacks(int square, uint64_t occupied) {
+    return bishopAttacks(square, occupied) | rookAttacks(square, occupied);
+}
+
+// Set the squares reachable by the given (x, y) offsets from every square.
+void initLeaperAttacks(uint64_t* attacks, const int offsets[][2], int count) {
+    for (int square = 0; square < BOARD_SIZE * BOARD_SIZE; square++) {
+        attacks[square] = 0;
+        for (int i = 0; i < count; i++) {
+            int x = square % BOARD_SIZE + offsets[i][0];
+            int y = square / BOARD_SIZE + offsets[i][1];
+            if (validBoardPosition(x, y)) {
+                attacks[square] |= SQUARE_BIT(y * BOARD_SIZE + x);
+            }
         }
     }
-    // West
-    else if (targetX > positionX) {
-        bounds = testCollision(board, positionX, positionY, 1, 0);
-        offsetX = 1;
-        offsetY = 0;
+}
+
+// Pawn structure masks. Files and their neighbours; the squares ahead of a pawn on its own and the neighbouring files,
+// which no enemy pawn may hold for it to be passed; the neighbouring files level with or behind it, where friendly
+// pawns could still support it; and the two rows in front of a king on its own and the neighbouring files.
+uint64_t fileMasks[BOARD_SIZE];
+uint64_t adjacentFileMasks[BOARD_SIZE];
+uint64_t passedPawnMasks[2][BOARD_SIZE * BOARD_SIZE];
+uint64_t pawnSupportMasks[2][BOARD_SIZE * BOARD_SIZE];
+uint64_t kingShieldMasks[2][BOARD_SIZE * BOARD_SIZE];
+
+// Fill the pawn structure masks.
+void initPawnMasks(void) {
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        fileMasks[x] = 0x0101010101010101ULL << x;
     }
-    // East
-    else {
-        bounds = testCollision(board, positionX, positionY, -1, 0);
-        offsetX = -1;
-        offsetY = 0;
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        adjacentFileMasks[x] = ((x > 0) ? fileMasks[x - 1] : 0) | ((x < BOARD_SIZE - 1) ? fileMasks[x + 1] : 0);
     }
 
-    // If the offset falls within the given bounds, allow movement there.
-    for (int i = 1; i < bounds; i++) {
-        int testX = positionX + (offsetX * i);
-        int testY = positionY + (offsetY * i);
-        bool locationMatch = (testX == targetX) && (testY == targetY);
-        
-        if (locationMatch) return true;
+    for (int square = 0; square < BOARD_SIZE * BOARD_SIZE; square++) {
+        int x = square % BOARD_SIZE;
+        int y = square / BOARD_SIZE;
+
+        for (int other = 0; other < BOARD_SIZE * BOARD_SIZE; other++) {
+            int dx = abs(other % BOARD_SIZE - x);
+            int dy = other / BOARD_SIZE - y; // White looks towards row 0, so its squares ahead have dy < 0.
+            uint64_t bit = SQUARE_BIT(other);
+
+            if (dx > 1) continue;
+            if (dy < 0) passedPawnMasks[WHITE][square] |= bit;
+            if (dy > 0) passedPawnMasks[BLACK][square] |= bit;
+            if (dx == 1 && dy >= 0) pawnSupportMasks[WHITE][square] |= bit;
+            if (dx == 1 && dy <= 0) pawnSupportMasks[BLACK][square] |= bit;
+            if (dy == -1 || dy == -2) kingShieldMasks[WHITE][square] |= bit;
+            if (dy == 1 || dy == 2) kingShieldMasks[BLACK][square] |= bit;
+        }
     }
+}
 
-    return false;
+// Build every attack table once, before any board is queried.
+void initAttackTables(void) {
+    const int knightOffsets[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+    const int kingOffsets[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+    // White pawns advance towards row 0, Black pawns towards row 7.
+    const int whitePawnOffsets[2][2] = {{-1, -1}, {1, -1}};
+    const int blackPawnOffsets[2][2] = {{-1, 1}, {1, 1}};
+
+    initLeaperAttacks(knightAttacks, knightOffsets, 8);
+    initLeaperAttacks(kingAttacks, kingOffsets, 8);
+    initLeaperAttacks(pawnAttacks[WHITE], whitePawnOffsets, 2);
+    initLeaperAttacks(pawnAttacks[BLACK], blackPawnOffsets, 2);
+
+    initMagics(bishopMagics, bishopTable, bishopMagicNumbers, bishopDirections);
+    initMagics(rookMagics, rookTable, rookMagicNumbers, rookDirections);
+
+    // The pawn structure masks are built along with them.
+    initPawnMasks();
 }
 
-// The Knight can jump over pieces, so its attack and movement helper functions are the same.
-bool knightMove(char* board, int targetX, int targetY, int positionX, int positionY) {
+// Scramble a 64-bit value, used to fill the Zobrist tables.
+uint64_t mixBits(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
 
-    if (abs(targetX - positionX) == 2 && abs(targetY - targetY) == 1) {
-        return true;
+// Random keys XORed together into a position key: one per piece on each square, one per set of
+// castling rights, one per En Passant file and one for Black to move.
+uint64_t zobristPieces[2][6][BOARD_SIZE * BOARD_SIZE];
+uint64_t zobristCastle[16];
+uint64_t zobristEnPassant[BOARD_SIZE];
+uint64_t zobristSide;
+
+// Fill the Zobrist tables from a fixed seed, so keys are the same on every run.
+void initZobrist(void) {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    for (int color = WHITE; color <= BLACK; color++) {
+        for (int type = PAWN; type <= KING; type++) {
+            for (int square = 0; square < BOARD_SIZE * BOARD_SIZE; square++) {
+                zobristPieces[color][type][square] = mixBits(seed++);
+            }
+        }
     }
-    else if (abs(targetX - positionX) == 1 && abs(targetY - positionY) == 2){
-        return true;
+    for (int rights = 0; rights < 16; rights++) {
+        zobristCastle[rights] = mixBits(seed++);
     }
-    else if (abs(targetY - positionY) == 2 && abs(targetX - positionX) == 1) {
-        return true;
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        zobristEnPassant[x] = mixBits(seed++);
     }
-    else if (abs(targetY - positionY) == 1 && abs(targetX - positionX) == 2){
-        return true;
+    zobristSide = mixBits(seed++);
+}
+
+// Every piece of either colour attacking a square, given an occupancy.
+uint64_t attackersTo(struct chessBoard* board, int square, uint64_t occupied) {
+    uint64_t diagonal = board->pieces[WHITE][BISHOP] | board->pieces[BLACK][BISHOP]
+                        | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+    uint64_t straight = board->pieces[WHITE][ROOK] | board->pieces[BLACK][ROOK]
+                        | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+
+    return (pawnAttacks[BLACK][square] & board->pieces[WHITE][PAWN])
+           | (pawnAttacks[WHITE][square] & board->pieces[BLACK][PAWN])
+           | (knightAttacks[square] & (board->pieces[WHITE][KNIGHT] | board->pieces[BLACK][KNIGHT]))
+           | (kingAttacks[square] & (board->pieces[WHITE][KING] | board->pieces[BLACK][KING]))
+           | (bishopAttacks(square, occupied) & diagonal)
+           | (rookAttacks(square, occupied) & straight);
+}
+
+// Squares attacked by a piece standing on a square, given an occupancy.
+uint64_t pieceAttacks(char piece, int square, uint64_t occupied) {
+    switch(pieceType(piece)) {
+        case PAWN:
+            return pawnAttacks[pieceColor(piece)][square];
+        case KNIGHT:
+            return knightAttacks[square];
+        case BISHOP:
+            return bishopAttacks(square, occupied);
+        case ROOK:
+            return rookAttacks(square, occupied);
+        case QUEEN:
+            return queenAttacks(square, occupied);
+        case KING:
+            return kingAttacks[square];
+        default:
+            return 0;
     }
-    else {
-        return false;
+}
+
+// A middlegame and an endgame score packed into one int, so both can be summed with a single add.
+// The endgame half sits in the upper 16 bits, borrowing one from it when the middlegame half is negative.
+#define S(mg, eg) ((int)((unsigned int)(eg) << 16) + (mg))
+#define MG_SCORE(score) ((int16_t)(uint16_t)(unsigned int)(score))
+#define EG_SCORE(score) ((int16_t)(uint16_t)(((unsigned int)(score) + 0x8000) >> 16))
+
+// What each piece is worth on each square for White, material included, at the start and the end of the game.
+// Squares run from a8, as the board is drawn; Black reads the table upside down. The values are the PeSTO tables.
+const int pieceSquareTables[6][BOARD_SIZE * BOARD_SIZE] = {
+    // Pawns
+    {
+        S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94),
+        S(180, 272), S(216, 267), S(143, 252), S(177, 228), S(150, 241), S(208, 226), S(116, 259), S(71, 281),
+        S(76, 188), S(89, 194), S(108, 179), S(113, 161), S(147, 150), S(138, 147), S(107, 176), S(62, 178),
+        S(68, 126), S(95, 118), S(88, 107), S(103, 99), S(105, 92), S(94, 98), S(99, 111), S(59, 111),
+        S(55, 107), S(80, 103), S(77, 91), S(94, 87), S(99, 87), S(88, 86), S(92, 97), S(57, 93),
+        S(56, 98), S(78, 101), S(78, 88), S(72, 95), S(85, 94), S(85, 89), S(115, 93), S(70, 86),
+        S(47, 107), S(81, 102), S(62, 102), S(59, 104), S(67, 107), S(106, 94), S(120, 96), S(60, 87),
+        S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94), S(82, 94)
+    },
+    // Knights
+    {
+        S(170, 223), S(248, 243), S(303, 268), S(288, 253), S(398, 250), S(240, 254), S(322, 218), S(230, 182),
+        S(264, 256), S(296, 273), S(409, 256), S(373, 279), S(360, 272), S(399, 256), S(344, 257), S(320, 229),
+        S(290, 257), S(397, 261), S(374, 291), S(402, 290), S(421, 280), S(466, 272), S(410, 262), S(381, 240),
+        S(328, 264), S(354, 284), S(356, 303), S(390, 303), S(374, 303), S(406, 292), S(355, 289), S(359, 263),
+        S(324, 263), S(341, 275), S(353, 297), S(350, 306), S(365, 297), S(356, 298), S(358, 285), S(329, 263),
+        S(314, 258), S(328, 278), S(349, 280), S(347, 296), S(356, 291), S(354, 278), S(362, 261), S(321, 259),
+        S(308, 239), S(284, 261), S(325, 271), S(334, 276), S(336, 279), S(355, 261), S(323, 258), S(318, 237),
+        S(232, 252), S(316, 230), S(279, 258), S(304, 266), S(320, 259), S(309, 263), S(318, 231), S(314, 217)
+    },
+    // Bishops
+    {
+        S(336, 283), S(369, 276), S(283, 286), S(328, 289), S(340, 290), S(323, 288), S(372, 280), S(357, 273),
+        S(339, 289), S(381, 293), S(347, 304), S(352, 285), S(395, 294), S(424, 284), S(383, 293), S(318, 283),
+        S(349, 299), S(402, 289), S(408, 297), S(405, 296), S(400, 295), S(415, 303), S(402, 297), S(363, 301),
+        S(361, 294), S(370, 306), S(384, 309), S(415, 306), S(402, 311), S(402, 307), S(372, 300), S(363, 299),
+        S(359, 291), S(378, 300), S(378, 310), S(391, 316), S(399, 304), S(377, 307), S(375, 294), S(369, 288),
+        S(365, 285), S(380, 294), S(380, 305), S(380, 307), S(379, 310), S(392, 300), S(383, 290), S(375, 282),
+        S(369, 283), S(380, 279), S(381, 290), S(365, 296), S(372, 301), S(386, 288), S(398, 282), S(366, 270),
+        S(332, 274), S(362, 288), S(351, 274), S(344, 292), S(352, 288), S(353, 281), S(326, 292), S(344, 280)
+    },
+    // Rooks
+    {
+        S(509, 525), S(519, 522), S(509, 530), S(528, 527), S(540, 524), S(486, 524), S(508, 520), S(520, 517),
+        S(504, 523), S(509, 525), S(535, 525), S(539, 523), S(557, 509), S(544, 515), S(503, 520), S(521, 515),
+        S(472, 519), S(496, 519), S(503, 519), S(513, 517), S(494, 516), S(522, 509), S(538, 507), S(493, 509),
+        S(453, 516), S(466, 515), S(484, 525), S(503, 513), S(501, 514), S(512, 513), S(469, 511), S(457, 514),
+        S(441, 515), S(451, 517), S(465, 520), S(476, 516), S(486, 507), S(470, 506), S(483, 504), S(454, 501),
+        S(432, 508), S(452, 512), S(461, 507), S(460, 511), S(480, 505), S(477, 500), S(472, 504), S(444, 496),
+        S(433, 506), S(461, 506), S(457, 512), S(468, 514), S(476, 503), S(488, 503), S(471, 501), S(406, 509),
+        S(458, 503), S(464, 514), S(478, 515), S(494, 511), S(493, 507), S(484, 499), S(440, 516), S(451, 492)
+    },
+    // Queens
+    {
+        S(997, 927), S(1025, 958), S(1054, 958), S(1037, 963), S(1084, 963), S(1069, 955), S(1068, 946), S(1070, 956),
+        S(1001, 919), S(986, 956), S(1020, 968), S(1026, 977), S(1009, 994), S(1082, 961), S(1053, 966), S(1079, 936),
+        S(1012, 916), S(1008, 942), S(1032, 945), S(1033, 985), S(1054, 983), S(1081, 971), S(1072, 955), S(1082, 945),
+        S(998, 939), S(998, 958), S(1009, 960), S(1009, 981), S(1024, 993), S(1042, 976), S(1023, 993), S(1026, 972),
+        S(1016, 918), S(999, 964), S(1016, 955), S(1015, 983), S(1023, 967), S(1021, 970), S(1028, 975), S(1022, 959),
+        S(1011, 920), S(1027, 909), S(1014, 951), S(1023, 942), S(1020, 945), S(1027, 953), S(1039, 946), S(1030, 941),
+        S(990, 914), S(1017, 913), S(1036, 906), S(1027, 920), S(1033, 920), S(1040, 913), S(1022, 900), S(1026, 904),
+        S(1024, 903), S(1007, 908), S(1016, 914), S(1035, 893), S(1010, 931), S(1000, 904), S(994, 916), S(975, 895)
+    },
+    // King
+    {
+        S(-65, -74), S(23, -35), S(16, -18), S(-15, -18), S(-56, -11), S(-34, 15), S(2, 4), S(13, -17),
+        S(29, -12), S(-1, 17), S(-20, 14), S(-7, 17), S(-8, 17), S(-4, 38), S(-38, 23), S(-29, 11),
+        S(-9, 10), S(24, 17), S(2, 23), S(-16, 15), S(-20, 20), S(6, 45), S(22, 44), S(-22, 13),
+        S(-17, -8), S(-20, 22), S(-12, 24), S(-27, 27), S(-30, 26), S(-25, 33), S(-14, 26), S(-36, 3),
+        S(-49, -18), S(-1, -4), S(-27, 21), S(-39, 24), S(-46, 27), S(-44, 23), S(-33, 9), S(-51, -11),
+        S(-14, -19), S(-14, -3), S(-22, 11), S(-46, 21), S(-44, 23), S(-30, 16), S(-15, 7), S(-27, -9),
+        S(1, -27), S(7, -11), S(-8, 4), S(-64, 13), S(-43, 14), S(-16, 4), S(9, -5), S(8, -17),
+        S(-15, -53), S(36, -34), S(12, -21), S(-54, -11), S(8, -28), S(-28, -14), S(24, -24), S(14, -43)
     }
+};
+
+// How much each piece type counts towards the middlegame: 24 with every piece on the board, 0 with only pawns and kings.
+const int phaseWeights[6] = {0, 1, 1, 2, 4, 0};
+#define MAX_PHASE 24
+
+// The packed score a piece on a square adds to White's side of the evaluation.
+int pieceSquareScore(char piece, int square) {
+    int type = pieceType(piece);
+    return (pieceColor(piece) == WHITE) ? pieceSquareTables[type][square] : -pieceSquareTables[type][square ^ 56];
 }
 
-// Check if Bishop can attack a given location.
-bool bishopAttack(char* board, int positionX, int positionY, int targetX, int targetY) {
-
-    // Collision detection.
-    int offsetSE = testCollision(board, positionX, positionY, 1, 1);
-    int offsetNW = testCollision(board, positionX, positionY, -1, -1);
-    int offsetSW = testCollision(board, positionX, positionY, -1, 1);
-    int offsetNE = testCollision(board, positionX, positionY, 1, -1);
-
-    // Calculate non-proximity offsets.
-    bool SE = ((positionX + (offsetSE * 1)) == targetX) && (positionY + (offsetSE * 1) == targetY);
-    bool NW = ((positionX + (offsetNW * -1)) == targetX) && (positionY + (offsetNW * -1) == targetY);
-    bool SW = ((positionX + (offsetSW * -1)) == targetX) && (positionY + (offsetSW * 1) == targetY);
-    bool NE = ((positionX + (offsetNE * 1)) == targetX) && (positionY + (offsetNE * -1) == targetY);
-
-    // Positions direct to the offset will report value zero - these can't be multiplied and need to be done too.
-    bool SEP = ((positionX + 1 == targetX) && (positionY + 1 == targetY));
-    bool NWP = ((positionX + -1 == targetX) && (positionY + -1 == targetY));
-    bool SWP = ((positionX + -1 == targetX) && (positionY + 1 == targetY));
-    bool NEP = ((positionX + 1 == targetX) && (positionY + -1 == targetY));
-
-    // If any of these locations, allow movement.
-    if (SE) return true;
-    if (NW) return true;
-    if (SW) return true;
-    if (NE) return true;
-
-    if (SEP) return true;
-    if (NWP) return true;
-    if (SWP) return true;
-    if (NEP) return true;
+// The optional neural network evaluation. Its first layer has a weight row for every (king square, piece, square)
+// feature as seen from each side, HalfKP style: pieces other than kings, placed relative to that side's own king,
+// with Black's view turned upside down so both sides read the same weights. A side's accumulator sums the rows of
+// every feature on the board and is kept up to date by setSquare, so only the small layers after it are run per call.
+#define NNUE_FEATURES (BOARD_SIZE * BOARD_SIZE * 10 * BOARD_SIZE * BOARD_SIZE)
+#define NNUE_LAYER 32
+#define NNUE_CLIP 127 // Activations are clipped to 0..NNUE_CLIP between layers, so they fit in a byte.
+#define NNUE_SHIFT 6 // Hidden layer sums are scaled down by 2^NNUE_SHIFT before clipping.
+#define NNUE_OUTPUT_SCALE 16 // Network outputs per centipawn.
+#define NNUE_MAGIC "C99NNUE1"
+
+// Weights of a network, in the order they are stored in its file after the magic, little-endian.
+// The first layer's input is the side to move's accumulator followed by the other side's.
+struct nnueNetwork
+{
+    int16_t featureBiases[NNUE_HIDDEN];
+    int16_t* featureWeights; // NNUE_FEATURES rows of NNUE_HIDDEN.
+    int32_t hidden1Biases[NNUE_LAYER];
+    int8_t hidden1Weights[NNUE_LAYER][2 * NNUE_HIDDEN];
+    int32_t hidden2Biases[NNUE_LAYER];
+    int8_t hidden2Weights[NNUE_LAYER][NNUE_LAYER];
+    int32_t outputBias;
+    int8_t outputWeights[NNUE_LAYER];
+};
 
-    return false;
+// The inner loops of the network, in the widest instruction set the processor has.
+// Counts are multiples of 32 and layers have a multiple of 4 outputs.
+struct nnueKernels
+{
+    const char* name;
+    void (*addRow)(int16_t* accumulator, const int16_t* row);
+    void (*subtractRow)(int16_t* accumulator, const int16_t* row);
+    void (*clip)(const int16_t* input, uint8_t* output, int count);
+    void (*layer)(const uint8_t* input, int inputCount, const int8_t* weights, const int32_t* biases, int32_t* output, int outputCount);
+};
+
+// The loaded network, or NULL to use the piece-square evaluation. Boards whose accumulators were
+// built for an older network than networkVersion rebuild them before evaluating.
+struct nnueNetwork* network = NULL;
+int networkVersion = 0;
+struct nnueKernels nnueKernels;
+
+void addRowScalar(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i++) accumulator[i] = (int16_t)(accumulator[i] + row[i]);
 }
 
-// Check if Rook can attack a given location.
-bool rookAttack(char* board, int positionX, int positionY, int targetX, int targetY) {
-
-    int offsetN = testCollision(board, positionX, positionY, 0, 1);
-    int offsetS = testCollision(board, positionX, positionY, 0, -1);
-    int offsetW = testCollision(board, positionX, positionY, -1, 0);
-    int offsetE = testCollision(board, positionX, positionY, 1, 0);
-
-    // Calculate direct offsets.
-    bool NORTHP = (positionX == targetX) && (positionY + 1 == targetY);
-    bool SOUTHP = (positionX == targetX) && (positionY -1 == targetY);
-    bool WESTP = (positionX -1 == targetX) && (positionY == targetY);
-    bool EASTP = (positionX + 1 == targetX) && (positionY == targetY);
-
-     // Positions direct to the offsets will report value zero - these can't be multiplied and need to be done too.
-    bool NORTH = ((positionX + (offsetN * 0)) == targetX) && (positionY + (offsetN * 1) == targetY);
-    bool SOUTH = ((positionX + (offsetS * 0)) == targetX) && (positionY + (offsetS * -1) == targetY);
-    bool WEST = ((positionX + (offsetW * -1)) == targetX) && (positionY + (offsetW * 0) == targetY);
-    bool EAST = ((positionX + (offsetE * 1)) == targetX) && (positionY + (offsetE * 0) == targetY);
-
-    if (NORTH) return true;
-    if (SOUTH) return true;
-    if (WEST) return true;
-    if (EAST) return true;
-
-    if (NORTHP) return true;
-    if (SOUTHP) return true;
-    if (WESTP) return true;
-    if (EASTP) return true;
+void subtractRowScalar(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i++) accumulator[i] = (int16_t)(accumulator[i] - row[i]);
+}
 
-    return false;
+void clipScalar(const int16_t* input, uint8_t* output, int count) {
+    for (int i = 0; i < count; i++) output[i] = (input[i] < 0) ? 0 : (input[i] > NNUE_CLIP) ? NNUE_CLIP : input[i];
 }
 
-// Special En Passant helper function.
-char convertSpecialPiece(char piece) {
-    switch(piece) {
-        case 'E': // Double-Step Pawn White
-            return 'A';
-        case 'e': // Double-Step Pawn Black
-            return 'a';
-        case 'A': // En Passant White
-            return 'P';
-        case 'a': // En Passant Black
-            return 'p';
-        default:
-            return piece;
+// A dense layer: each output is its bias plus its row of weights times the input.
+void layerScalar(const uint8_t* input, int inputCount, const int8_t* weights, const int32_t* biases, int32_t* output, int outputCount) {
+    for (int i = 0; i < outputCount; i++) {
+        int32_t sum = biases[i];
+        for (int j = 0; j < inputCount; j++) sum += input[j] * weights[i * inputCount + j];
+        output[i] = sum;
     }
 }
 
-// Header files? Never heard of them.
-bool isAttackLegal(char* board, char piece, int targetX, int targetY, int positionX, int positionY, char turn);
+#ifdef NNUE_X86
+// SSE2 versions, sixteen bytes at a time.
+__attribute__((target("sse2"))) void addRowSse2(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i sum = _mm_add_epi16(_mm_loadu_si128((__m128i*)(accumulator + i)), _mm_loadu_si128((const __m128i*)(row + i)));
+        _mm_storeu_si128((__m128i*)(accumulator + i), sum);
+    }
+}
 
-// Check if the King is in check, given a player.
-bool kingPassiveCheck(char* board, char turn) {
-    int kingBlackX;
-    int kingBlackY;
-    int kingWhiteX;
-    int kingWhiteY;
+__attribute__((target("sse2"))) void subtractRowSse2(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i difference = _mm_sub_epi16(_mm_loadu_si128((__m128i*)(accumulator + i)), _mm_loadu_si128((const __m128i*)(row + i)));
+        _mm_storeu_si128((__m128i*)(accumulator + i), difference);
+    }
+}
 
-    for (int y = 0; y < BOARD_SIZE; y++) {
-        for (int x = 0; x < BOARD_SIZE; x++) {
-            if (getGridItem(board, x, y) == 'K') {
-                kingWhiteX = x;
-                kingWhiteY = y;
-            }
-            else if (getGridItem(board, x, y) == 'k') {
-                kingBlackX = x;
-                kingBlackY = y;
-            }
-        }
+__attribute__((target("sse2"))) void clipSse2(const int16_t* input, uint8_t* output, int count) {
+    __m128i high = _mm_set1_epi16(NNUE_CLIP);
+    for (int i = 0; i < count; i += 16) {
+        // Packing with unsigned saturation takes care of the negative values.
+        __m128i low = _mm_min_epi16(_mm_loadu_si128((const __m128i*)(input + i)), high);
+        __m128i upper = _mm_min_epi16(_mm_loadu_si128((const __m128i*)(input + i + 8)), high);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_packus_epi16(low, upper));
     }
+}
 
-    for (int y = 0; y < BOARD_SIZE; y++) {
-        for (int x = 0; x < BOARD_SIZE; x++) {
-            char piece = getGridItem(board, x, y);
-            bool isLegal = isAttackLegal(board, piece, kingBlackX, kingBlackY, x, y, turn);
-            
-            // Black is check
-            if (isLegal) {
-                return true;
+// Four outputs at a time, so each block of input is widened once for all four and their sums are folded together.
+__attribute__((target("sse2"))) void layerSse2(const uint8_t* input, int inputCount, const int8_t* weights, const int32_t* biases,
+                                               int32_t* output, int outputCount) {
+    __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < outputCount; i += 4) {
+        const int8_t* row = weights + i * inputCount;
+        __m128i sums[4] = {zero, zero, zero, zero};
+        for (int j = 0; j < inputCount; j += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(input + j));
+            __m128i low = _mm_unpacklo_epi8(bytes, zero);
+            __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            for (int k = 0; k < 4; k++) {
+                // Sign-extend the weights to 16 bits by putting each byte in the top half and shifting it down.
+                __m128i weight = _mm_loadu_si128((const __m128i*)(row + k * inputCount + j));
+                __m128i weightLow = _mm_srai_epi16(_mm_unpacklo_epi8(weight, weight), 8);
+                __m128i weightHigh = _mm_srai_epi16(_mm_unpackhi_epi8(weight, weight), 8);
+                sums[k] = _mm_add_epi32(sums[k], _mm_add_epi32(_mm_madd_epi16(low, weightLow), _mm_madd_epi16(high, weightHigh)));
             }
         }
+        __m128i pairs01 = _mm_add_epi32(_mm_unpacklo_epi32(sums[0], sums[1]), _mm_unpackhi_epi32(sums[0], sums[1]));
+        __m128i pairs23 = _mm_add_epi32(_mm_unpacklo_epi32(sums[2], sums[3]), _mm_unpackhi_epi32(sums[2], sums[3]));
+        __m128i total = _mm_add_epi32(_mm_unpacklo_epi64(pairs01, pairs23), _mm_unpackhi_epi64(pairs01, pairs23));
+        _mm_storeu_si128((__m128i*)(output + i), _mm_add_epi32(total, _mm_loadu_si128((const __m128i*)(biases + i))));
     }
+}
 
-    for (int y = 0; y < BOARD_SIZE; y++) {
-        for (int x = 0; x < BOARD_SIZE; x++) {
-            char piece = getGridItem(board, x, y);
-            bool isLegal = isAttackLegal(board, piece, kingWhiteX, kingWhiteY, x, y, turn);
-            
-            // White is check
-            if (isLegal) {
-                return true;
-            }
-        }
+// AVX2 versions, thirty-two bytes at a time.
+__attribute__((target("avx2"))) void addRowAvx2(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i sum = _mm256_add_epi16(_mm256_loadu_si256((__m256i*)(accumulator + i)), _mm256_loadu_si256((const __m256i*)(row + i)));
+        _mm256_storeu_si256((__m256i*)(accumulator + i), sum);
     }
+}
 
-    return false;
+__attribute__((target("avx2"))) void subtractRowAvx2(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i difference = _mm256_sub_epi16(_mm256_loadu_si256((__m256i*)(accumulator + i)), _mm256_loadu_si256((const __m256i*)(row + i)));
+        _mm256_storeu_si256((__m256i*)(accumulator + i), difference);
+    }
 }
 
-// Check if the King will be in check, given a possible movement by the king.
-bool kingActiveCheck(char* board, char pieceKing, int targetX, int targetY, int positionX, int positionY, char turn) {
-    
-    char pieceAtTarget = getGridItem(board, targetX, targetY);
-    setGridItem(board, positionX, positionY, '.');
-    setGridItem(board, targetX, targetY, pieceKing);
-    
-    for (int y = 0; y < BOARD_SIZE; y++) {
-        for (int x = 0; x < BOARD_SIZE; x++) {
-            char piece = getGridItem(board, x, y);
-            bool isLegal = isAttackLegal(board, piece, targetX, targetY, x, y, turn);
+__attribute__((target("avx2"))) void clipAvx2(const int16_t* input, uint8_t* output, int count) {
+    __m256i high = _mm256_set1_epi16(NNUE_CLIP);
+    for (int i = 0; i < count; i += 32) {
+        __m256i low = _mm256_min_epi16(_mm256_loadu_si256((const __m256i*)(input + i)), high);
+        __m256i upper = _mm256_min_epi16(_mm256_loadu_si256((const __m256i*)(input + i + 16)), high);
+        // The pack works within each 128-bit lane, so the middle quarters come out swapped.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, upper), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i*)(output + i), packed);
+    }
+}
 
-            bool notOwnTurn = (turn != whosePiece(pieceKing));
-            
-            if (isLegal && notOwnTurn) {
-                setGridItem(board, targetX, targetY, pieceAtTarget);
-                setGridItem(board, positionX, positionY, pieceKing);
-                return false;
-            }
-            else if (isLegal && ~notOwnTurn) {
-                setGridItem(board, targetX, targetY, pieceAtTarget);
-                setGridItem(board, positionX, positionY, pieceKing);
-                return true;
+// Bytes are multiplied straight into pairs of 16-bit sums, which cannot overflow with inputs of at most NNUE_CLIP.
+__attribute__((target("avx2"))) void layerAvx2(const uint8_t* input, int inputCount, const int8_t* weights, const int32_t* biases,
+                                               int32_t* output, int outputCount) {
+    __m256i ones = _mm256_set1_epi16(1);
+    for (int i = 0; i < outputCount; i += 4) {
+        const int8_t* row = weights + i * inputCount;
+        __m256i sums[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+        for (int j = 0; j < inputCount; j += 32) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*)(input + j));
+            for (int k = 0; k < 4; k++) {
+                __m256i pairs = _mm256_maddubs_epi16(bytes, _mm256_loadu_si256((const __m256i*)(row + k * inputCount + j)));
+                sums[k] = _mm256_add_epi32(sums[k], _mm256_madd_epi16(pairs, ones));
             }
         }
+        __m256i folded = _mm256_hadd_epi32(_mm256_hadd_epi32(sums[0], sums[1]), _mm256_hadd_epi32(sums[2], sums[3]));
+        __m128i total = _mm_add_epi32(_mm256_castsi256_si128(folded), _mm256_extracti128_si256(folded, 1));
+        _mm_storeu_si128((__m128i*)(output + i), _mm_add_epi32(total, _mm_loadu_si128((const __m128i*)(biases + i))));
     }
-    setGridItem(board, positionX, positionY, pieceKing);
-    setGridItem(board, targetX, targetY, pieceAtTarget);
-    return true;
+}
+#endif
+
+// Pick the kernels for the processor the program is running on.
+void selectKernels(void) {
+    const struct nnueKernels scalar = {"scalar", addRowScalar, subtractRowScalar, clipScalar, layerScalar};
+    nnueKernels = scalar;
+
+#ifdef NNUE_X86
+    const struct nnueKernels sse2 = {"sse2", addRowSse2, subtractRowSse2, clipSse2, layerSse2};
+    const struct nnueKernels avx2 = {"avx2", addRowAvx2, subtractRowAvx2, clipAvx2, layerAvx2};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) nnueKernels = avx2;
+    else if (__builtin_cpu_supports("sse2")) nnueKernels = sse2;
+#endif
 }
 
-// Check if the King can move to a given adjacent tile.
-bool kingMove(char* board, char piece, int targetX, int targetY, int positionX, int positionY, char turn) {
-    
-    char pieceKing = getGridItem(board, positionX, positionY);
-    
-    // For each up, down, left and right offset, detect if the King will be in check.
-    if ((targetX - positionX) == 0 && abs(targetY - targetY) == 1) {
-        return kingActiveCheck(board, pieceKing, targetX, targetY, positionX, positionY, turn);
-    }
-    else if (abs(targetX - positionX) == 1 && (targetY == positionY)) {
-        return kingActiveCheck(board, pieceKing, targetX, targetY, positionX, positionY, turn);
+// Read a network from a file and evaluate with it from now on. On failure the evaluation in use is kept.
+bool loadNetwork(const char* path) {
+    FILE* file = fopen(path, "rb");
+    struct nnueNetwork* loaded = NULL;
+    char magic[sizeof(NNUE_MAGIC) - 1];
+    bool valid = false;
+
+    if (file != NULL && posix_memalign((void**)&loaded, 64, sizeof(struct nnueNetwork)) == 0) {
+        loaded->featureWeights = NULL;
+        size_t rows = (size_t)NNUE_FEATURES * NNUE_HIDDEN;
+        valid = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+                && memcmp(magic, NNUE_MAGIC, sizeof(magic)) == 0
+                && fread(loaded->featureBiases, sizeof(int16_t), NNUE_HIDDEN, file) == NNUE_HIDDEN
+                && posix_memalign((void**)&loaded->featureWeights, 64, rows * sizeof(int16_t)) == 0
+                && fread(loaded->featureWeights, sizeof(int16_t), rows, file) == rows
+                && fread(loaded->hidden1Biases, sizeof(int32_t), NNUE_LAYER, file) == NNUE_LAYER
+                && fread(loaded->hidden1Weights, 1, sizeof(loaded->hidden1Weights), file) == sizeof(loaded->hidden1Weights)
+                && fread(loaded->hidden2Biases, sizeof(int32_t), NNUE_LAYER, file) == NNUE_LAYER
+                && fread(loaded->hidden2Weights, 1, sizeof(loaded->hidden2Weights), file) == sizeof(loaded->hidden2Weights)
+                && fread(&loaded->outputBias, sizeof(int32_t), 1, file) == 1
+                && fread(loaded->outputWeights, 1, sizeof(loaded->outputWeights), file) == sizeof(loaded->outputWeights)
+                && fgetc(file) == EOF;
     }
-    else if (abs(targetX - positionX) == 0 && abs(targetY - positionY) == 1) {
-        return kingActiveCheck(board, pieceKing, targetX, targetY, positionX, positionY, turn);
-    }
-    else if (abs(targetY - positionY) == 1 && abs(targetX - positionX) == 1) {
-        return kingActiveCheck(board, pieceKing, targetX, targetY, positionX, positionY, turn);
-    }
-    else {
+    if (file != NULL) fclose(file);
+
+    if (!valid) {
+        if (loaded != NULL) free(loaded->featureWeights);
+        free(loaded);
+        fprintf(stderr, "Could not load network %s, keeping the current evaluation\n", path);
         return false;
     }
+
+    selectKernels();
+    if (network != NULL) {
+        free(network->featureWeights);
+        free(network);
+    }
+    network = loaded;
+    networkVersion++;
+    return true;
 }
 
-// Segmentation fault. Probably the use of nested for-loops that end up chaining isAttackLegal()
-
-// Detect check, given a player.
-// char detectCheck(char* board, char pieceMove, int targetX, int targetY, int positionX, int positionY, char turn) {
-
-//     char pieceAtTarget = getGridItem(board, targetX, targetY);
-//     setGridItem(board, targetX, targetY, pieceMove);
-//     setGridItem(board, positionX, positionY, pieceAtTarget);
+// Go back to the piece-square evaluation.
+void unloadNetwork(void) {
+    if (network == NULL) return;
+    free(network->featureWeights);
+    free(network);
+    network = NULL;
+}
 
-//     for (int y = 0; y < BOARD_SIZE; y++) {
-//         for (int x = 0; x < BOARD_SIZE; x++) {
-//             if (getGridItem(board, x, y) == 'k') {
-//                 if (kingPassiveCheck(board, turn)) {
-//                     setGridItem(board, targetX, targetY, pieceAtTarget);
-//                     setGridItem(board, positionX, positionY, pieceMove);
-//                     return 'k';
-                    
-//                 }
-//             }
-//             else if (getGridItem(board, x, y) == 'K') {
-//                 if (kingPassiveCheck(board, turn)) {
-//                     setGridItem(board, targetX, targetY, pieceAtTarget);
-//                     setGridItem(board, positionX, positionY, pieceMove);
-//                     return 'K';
-//                 }
-//             }
-//         }
-//     }
+// The first layer's weights for a piece on a square, seen by the given side with its king on kingSquare.
+const int16_t* featureRow(int perspective, int kingSquare, char piece, int square) {
+    int flip = (perspective == WHITE) ? 0 : 56;
+    int feature = pieceType(piece) * 2 + (pieceColor(piece) != perspective);
+    return network->featureWeights + ((size_t)((kingSquare ^ flip) * 10 + feature) * 64 + (square ^ flip)) * NNUE_HIDDEN;
+}
 
-//     setGridItem(board, targetX, targetY, pieceAtTarget);
-//     setGridItem(board, positionX, positionY, pieceMove);
-//     return '.';
-// }
+// Add or take away a piece from both accumulators. Every feature of a side depends on where its king is,
+// so when a king moves its side's accumulator is left to be rebuilt at the next evaluation.
+void updateAccumulators(struct chessBoard* board, char piece, int square, void (*update)(int16_t*, const int16_t*)) {
+    for (int perspective = WHITE; perspective <= BLACK; perspective++) {
+        if (pieceType(piece) == KING) {
+            if (pieceColor(piece) == perspective) board->accumulatorStale[perspective] = true;
+        }
+        else if (!board->accumulatorStale[perspective]) {
+            update(board->accumulator[perspective], featureRow(perspective, board->kingSquare[perspective], piece, square));
+        }
+    }
+}
 
-// Simulate if a player's desired move will resolve the check.
-bool resolveCheck(char* board, char pieceMove, int targetX, int targetY, int positionX, int positionY, int kingX, int kingY, char turn) {
+// Build a side's accumulator from every piece on the board.
+void refreshAccumulator(struct chessBoard* board, int perspective) {
+    int16_t* accumulator = board->accumulator[perspective];
+    memcpy(accumulator, network->featureBiases, sizeof(network->featureBiases));
 
-    char pieceAtTarget = getGridItem(board, targetX, targetY);
-    setGridItem(board, targetX, targetY, pieceMove);
-    setGridItem(board, positionX, positionY, '0');
+    for (uint64_t pieces = board->occupied & ~(board->pieces[WHITE][KING] | board->pieces[BLACK][KING]); pieces; pieces &= pieces - 1) {
+        int square = __builtin_ctzll(pieces);
+        nnueKernels.addRow(accumulator, featureRow(perspective, board->kingSquare[perspective], board->grid[square], square));
+    }
+    board->accumulatorStale[perspective] = false;
+}
 
-    if(kingPassiveCheck(board, turn)) {
-        setGridItem(board, targetX, targetY, pieceAtTarget);
-        setGridItem(board, positionX, positionY, pieceMove);
-        return false;
+// Scale a hidden layer's sums down and clip them into the next layer's input.
+void activateLayer(const int32_t* sums, uint8_t* output) {
+    for (int i = 0; i < NNUE_LAYER; i++) {
+        int32_t value = sums[i] >> NNUE_SHIFT;
+        output[i] = (value < 0) ? 0 : (value > NNUE_CLIP) ? NNUE_CLIP : value;
     }
-    
-    setGridItem(board, targetX, targetY, pieceAtTarget);
-    setGridItem(board, positionX, positionY, pieceMove);
-    return true;
 }
 
-// Special helper function for Castling.
-bool isQueensideCastleWhiteLegal(char* board, char turn) {
-
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 4, 7, 'K');
-        setGridItem(board, 3, 7, '0');
-        setGridItem(board, 2, 7, '0');
-        setGridItem(board, 1, 7, '0');
-        setGridItem(board, 0, 7, 'R');
-        return false;
+// Score of the position for the side to move by the loaded network, in centipawns.
+int evaluateNetwork(struct chessBoard* board) {
+    uint8_t input[2 * NNUE_HIDDEN];
+    uint8_t hidden1[NNUE_LAYER];
+    uint8_t hidden2[NNUE_LAYER];
+    int32_t sums[NNUE_LAYER];
+
+    if (board->accumulatorVersion != networkVersion) {
+        board->accumulatorVersion = networkVersion;
+        board->accumulatorStale[WHITE] = true;
+        board->accumulatorStale[BLACK] = true;
+    }
+    for (int perspective = WHITE; perspective <= BLACK; perspective++) {
+        if (board->accumulatorStale[perspective]) refreshAccumulator(board, perspective);
     }
 
-    setGridItem(board, 4, 7, '0');
-    setGridItem(board, 3, 7, 'K');
+    nnueKernels.clip(board->accumulator[board->side], input, NNUE_HIDDEN);
+    nnueKernels.clip(board->accumulator[board->side ^ 1], input + NNUE_HIDDEN, NNUE_HIDDEN);
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 4, 7, 'K');
-        setGridItem(board, 3, 7, '0');
-        setGridItem(board, 2, 7, '0');
-        setGridItem(board, 1, 7, '0');
-        setGridItem(board, 0, 7, 'R');
-        return false;
+    nnueKernels.layer(input, 2 * NNUE_HIDDEN, network->hidden1Weights[0], network->hidden1Biases, sums, NNUE_LAYER);
+    activateLayer(sums, hidden1);
+    nnueKernels.layer(hidden1, NNUE_LAYER, network->hidden2Weights[0], network->hidden2Biases, sums, NNUE_LAYER);
+    activateLayer(sums, hidden2);
+
+    int32_t output = network->outputBias;
+    for (int i = 0; i < NNUE_LAYER; i++) output += hidden2[i] * network->outputWeights[i];
+    return output / NNUE_OUTPUT_SCALE;
+}
+
+// Set the item on a square, keeping the bitboards, attack maps and evaluation in step.
+void setSquare(struct chessBoard* board, int square, char item) {
+    uint64_t bit = SQUARE_BIT(square);
+    char previous = board->grid[square];
+    bool wasOccupied = (pieceType(previous) != NO_PIECE);
+    bool isOccupied = (pieceType(item) != NO_PIECE);
+
+    if (network != NULL && board->accumulatorVersion == networkVersion) {
+        if (wasOccupied) updateAccumulators(board, previous, square, nnueKernels.subtractRow);
+        if (isOccupied) updateAccumulators(board, item, square, nnueKernels.addRow);
     }
 
-    setGridItem(board, 3, 7, '0');
-    setGridItem(board, 2, 7, 'K');
+    if (wasOccupied) {
+        board->score -= pieceSquareScore(previous, square);
+        board->phase -= phaseWeights[pieceType(previous)];
+        board->key ^= zobristPieces[pieceColor(previous)][pieceType(previous)][square];
+        if (pieceType(previous) == PAWN) board->pawnKey ^= zobristPieces[pieceColor(previous)][PAWN][square];
+        board->pieces[pieceColor(previous)][pieceType(previous)] &= ~bit;
+        board->colors[pieceColor(previous)] &= ~bit;
+        board->occupied &= ~bit;
+    }
+    if (isOccupied) {
+        board->score += pieceSquareScore(item, square);
+        board->phase += phaseWeights[pieceType(item)];
+        board->key ^= zobristPieces[pieceColor(item)][pieceType(item)][square];
+        if (pieceType(item) == PAWN) board->pawnKey ^= zobristPieces[pieceColor(item)][PAWN][square];
+        board->pieces[pieceColor(item)][pieceType(item)] |= bit;
+        board->colors[pieceColor(item)] |= bit;
+        board->occupied |= bit;
+    }
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 4, 7, 'K');
-        setGridItem(board, 3, 7, '0');
-        setGridItem(board, 2, 7, '0');
-        setGridItem(board, 1, 7, '0');
-        setGridItem(board, 0, 7, 'R');
-        return false;
+    board->grid[square] = item;
+    board->attacks[square] = pieceAttacks(item, square, board->occupied);
+
+    // Sliders that see this square are blocked or unblocked by it, so only they need their attacks redone.
+    if (wasOccupied != isOccupied) {
+        uint64_t diagonal = board->pieces[WHITE][BISHOP] | board->pieces[BLACK][BISHOP]
+                            | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+        uint64_t straight = board->pieces[WHITE][ROOK] | board->pieces[BLACK][ROOK]
+                            | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+        uint64_t sliders = (bishopAttacks(square, board->occupied) & diagonal)
+                           | (rookAttacks(square, board->occupied) & straight);
+
+        while (sliders) {
+            int slider = __builtin_ctzll(sliders);
+            sliders &= sliders - 1;
+            board->attacks[slider] = pieceAttacks(board->grid[slider], slider, board->occupied);
+        }
     }
 
-    setGridItem(board, 4, 7, 'K');
-    setGridItem(board, 3, 7, '0');
-    setGridItem(board, 2, 7, '0');
-    setGridItem(board, 1, 7, '0');
-    setGridItem(board, 0, 7, 'R');
-    return true;
+    board->attackMapsStale = true;
 }
 
-// Special helper function for Castling.
-bool isKingsideCastleWhiteLegal(char* board, char turn) {
+// The part of the key for the En Passant state. It only counts when an enemy pawn stands beside
+// the pawn that double-stepped, since otherwise the position plays the same as without it.
+uint64_t enPassantKey(struct chessBoard* board) {
+    if (board->enPassant == OFF_BOARD) return 0;
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 7, 7, 'R');
-        setGridItem(board, 6, 7, '0');
-        setGridItem(board, 5, 7, '0');
-        setGridItem(board, 4, 7, 'K');
-        return false;
+    int victim = board->enPassant;
+    uint64_t bit = SQUARE_BIT(victim);
+    uint64_t beside = ((bit << 1) & ~0x0101010101010101ULL) | ((bit >> 1) & ~0x8080808080808080ULL);
+
+    if (board->pieces[pieceColor(board->grid[victim]) ^ 1][PAWN] & beside) {
+        return zobristEnPassant[victim % BOARD_SIZE];
     }
+    return 0;
+}
 
-    setGridItem(board, 4, 7, '0');
-    setGridItem(board, 5, 7, 'K');
+// Build the key of a position from scratch. Boards keep theirs up to date move by move,
+// so this is only needed when a position is set up.
+uint64_t computeKey(struct chessBoard* board) {
+    uint64_t key = zobristCastle[board->castleRights] ^ enPassantKey(board);
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 7, 7, 'R');
-        setGridItem(board, 6, 7, '0');
-        setGridItem(board, 5, 7, '0');
-        setGridItem(board, 4, 7, 'K');
-        return false;
+    for (int color = WHITE; color <= BLACK; color++) {
+        for (int type = PAWN; type <= KING; type++) {
+            for (uint64_t pieces = board->pieces[color][type]; pieces; pieces &= pieces - 1) {
+                key ^= zobristPieces[color][type][__builtin_ctzll(pieces)];
+            }
+        }
     }
 
-    setGridItem(board, 5, 7, '0');
-    setGridItem(board, 6, 7, 'K');
+    return (board->side == BLACK) ? key ^ zobristSide : key;
+}
+
+// Set the current item in a given board position.
+void setGridItem(struct chessBoard* board, int x, int y, char item) {
+    setSquare(board, y * BOARD_SIZE + x, item);
+}
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 7, 7, 'R');
-        setGridItem(board, 6, 7, '0');
-        setGridItem(board, 5, 7, '0');
-        setGridItem(board, 4, 7, 'K');
-        return false;
+// Every square attacked by the given colour. The per-side maps are folded from the
+// per-square attacks only when a query follows a change.
+uint64_t attackMap(struct chessBoard* board, int color) {
+    if (board->attackMapsStale) {
+        for (int side = WHITE; side <= BLACK; side++) {
+            uint64_t map = 0;
+            uint64_t pieces = board->colors[side];
+            while (pieces) {
+                map |= board->attacks[__builtin_ctzll(pieces)];
+                pieces &= pieces - 1;
+            }
+            board->attackMaps[side] = map;
+        }
+        board->attackMapsStale = false;
     }
 
-    setGridItem(board, 7, 7, 'R');
-    setGridItem(board, 6, 7, '0');
-    setGridItem(board, 5, 7, '0');
-    setGridItem(board, 4, 7, 'K');
-    return true;
+    return board->attackMaps[color];
 }
 
-// Special helper function for Castling.
-bool isQueensideCastleBlackLegal(char* board, char turn) {
-
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 4, 0, 'k');
-        setGridItem(board, 3, 0, '0');
-        setGridItem(board, 2, 0, '0');
-        setGridItem(board, 1, 0, '0');
-        setGridItem(board, 0, 0, 'r');
-        return false;
+// Collision detection for the Bishop piece for diagonal movement.
+bool bishopMove(struct chessBoard* board, int targetX, int targetY, int positionX, int positionY) {
+    uint64_t reach = bishopAttacks(positionY * BOARD_SIZE + positionX, board->occupied) & ~board->occupied;
+    return (reach & SQUARE_BIT(targetY * BOARD_SIZE + targetX)) != 0;
+}
+
+// Collision detection for the Rook piece for vertical and horizontal movement.
+bool rookMove(struct chessBoard* board, int targetX, int targetY, int positionX, int positionY) {
+    uint64_t reach = rookAttacks(positionY * BOARD_SIZE + positionX, board->occupied) & ~board->occupied;
+    return (reach & SQUARE_BIT(targetY * BOARD_SIZE + targetX)) != 0;
+}
+
+// The Knight can jump over pieces, so its attack and movement helper functions are the same.
+bool knightMove(int targetX, int targetY, int positionX, int positionY) {
+    return (knightAttacks[positionY * BOARD_SIZE + positionX] & SQUARE_BIT(targetY * BOARD_SIZE + targetX)) != 0;
+}
+
+// Check if Bishop can attack a given location.
+bool bishopAttack(struct chessBoard* board, int positionX, int positionY, int targetX, int targetY) {
+    uint64_t reach = bishopAttacks(positionY * BOARD_SIZE + positionX, board->occupied);
+    return (reach & SQUARE_BIT(targetY * BOARD_SIZE + targetX)) != 0;
+}
+
+// Check if Rook can attack a given location.
+bool rookAttack(struct chessBoard* board, int positionX, int positionY, int targetX, int targetY) {
+    uint64_t reach = rookAttacks(positionY * BOARD_SIZE + positionX, board->occupied);
+    return (reach & SQUARE_BIT(targetY * BOARD_SIZE + targetX)) != 0;
+}
+
+// Castling rights, packed into a single mask.
+#define CASTLE_WHITE_KINGSIDE 1
+#define CASTLE_WHITE_QUEENSIDE 2
+#define CASTLE_BLACK_KINGSIDE 4
+#define CASTLE_BLACK_QUEENSIDE 8
+
+// Moves are packed into 16 bits: the from square, the to square and a 4-bit flag.
+#define MOVE(from, to, flags) ((uint16_t)((from) | ((to) << 6) | ((flags) << 12)))
+#define MOVE_FROM(move) ((move) & 63)
+#define MOVE_TO(move) (((move) >> 6) & 63)
+#define MOVE_FLAGS(move) ((move) >> 12)
+
+#define MOVE_QUIET 0
+#define MOVE_DOUBLE_STEP 1
+#define MOVE_KING_CASTLE 2
+#define MOVE_QUEEN_CASTLE 3
+#define MOVE_CAPTURE 4
+#define MOVE_EN_PASSANT 5
+#define MOVE_PROMOTION 8 // Low two bits pick knight, bishop, rook or queen; combine with MOVE_CAPTURE.
+
+#define MOVE_IS_CAPTURE(move) (MOVE_FLAGS(move) & MOVE_CAPTURE)
+#define MOVE_IS_PROMOTION(move) (MOVE_FLAGS(move) & MOVE_PROMOTION)
+#define MOVE_PROMOTION_TYPE(move) (KNIGHT + (MOVE_FLAGS(move) & 3))
+
+// No chess position has more than 218 moves.
+#define MAX_MOVES 256
+
+// A fixed-size buffer of moves for one position.
+struct moveList
+{
+    uint16_t moves[MAX_MOVES];
+    int count;
+};
+
+// Castling rights that survive a piece leaving or landing on a square.
+int castleMask(int square) {
+    switch(square) {
+        case 0: // a8
+            return ~CASTLE_BLACK_QUEENSIDE;
+        case 4: // e8
+            return ~(CASTLE_BLACK_KINGSIDE | CASTLE_BLACK_QUEENSIDE);
+        case 7: // h8
+            return ~CASTLE_BLACK_KINGSIDE;
+        case 56: // a1
+            return ~CASTLE_WHITE_QUEENSIDE;
+        case 60: // e1
+            return ~(CASTLE_WHITE_KINGSIDE | CASTLE_WHITE_QUEENSIDE);
+        case 63: // h1
+            return ~CASTLE_WHITE_KINGSIDE;
+        default:
+            return ~0;
     }
-    setGridItem(board, 4, 0, '0');
-    setGridItem(board, 3, 0, 'k');
+}
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 4, 0, 'k');
-        setGridItem(board, 3, 0, '0');
-        setGridItem(board, 2, 0, '0');
-        setGridItem(board, 1, 0, '0');
-        setGridItem(board, 0, 0, 'r');
-        return false;
+// Make a move on the board, following the same castling and En Passant conventions as the game,
+// and push what is needed to take it back. The turn passes to the other side.
+void makeMove(struct chessBoard* board, uint16_t move) {
+    const char promotionPieces[2][4] = {{'N', 'B', 'R', 'Q'}, {'n', 'b', 'r', 'q'}};
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int flags = MOVE_FLAGS(move);
+    char piece = board->grid[from];
+    int us = pieceColor(piece);
+
+    // The pawn taken En Passant sits beside the moving pawn, not on the target square.
+    int captureSquare = (flags == MOVE_EN_PASSANT) ? (from / BOARD_SIZE) * BOARD_SIZE + to % BOARD_SIZE : to;
+
+    board->keyHistory[board->historyCount] = board->key;
+    struct undoRecord* record = &board->history[board->historyCount++];
+    record->move = move;
+    record->piece = piece;
+    record->captured = board->grid[captureSquare];
+    record->castleRights = board->castleRights;
+    record->enPassant = board->enPassant;
+    record->kingSquare[WHITE] = board->kingSquare[WHITE];
+    record->kingSquare[BLACK] = board->kingSquare[BLACK];
+    record->halfmoveClock = board->halfmoveClock;
+    record->reversiblePlies = board->reversiblePlies;
+
+    // The pieces are keyed as they move, the rest of the position is keyed again at the end.
+    board->key ^= zobristCastle[board->castleRights] ^ enPassantKey(board) ^ zobristSide;
+
+    board->halfmoveClock = (pieceType(piece) == PAWN || record->captured != '0') ? 0 : board->halfmoveClock + 1;
+
+    if (flags == MOVE_EN_PASSANT) {
+        setSquare(board, captureSquare, '0');
     }
-    setGridItem(board, 3, 0, '0');
-    setGridItem(board, 2, 0, 'k');
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 4, 0, 'k');
-        setGridItem(board, 3, 0, '0');
-        setGridItem(board, 2, 0, '0');
-        setGridItem(board, 1, 0, '0');
-        setGridItem(board, 0, 0, 'r');
-        return false;
+    if (MOVE_IS_PROMOTION(move)) {
+        piece = promotionPieces[us][MOVE_PROMOTION_TYPE(move) - KNIGHT];
     }
 
-    setGridItem(board, 4, 0, 'k');
-    setGridItem(board, 3, 0, '0');
-    setGridItem(board, 2, 0, '0');
-    setGridItem(board, 1, 0, '0');
-    setGridItem(board, 0, 0, 'r');
-    return true;
-}
+    setSquare(board, from, '0');
+    setSquare(board, to, piece);
 
-// Special helper function for Castling.
-bool isKingsideCastleBlackLegal(char* board, char turn) {
+    // The rook jumps over the king when castling.
+    if (flags == MOVE_KING_CASTLE) {
+        setSquare(board, to + 1, '0');
+        setSquare(board, to - 1, (us == WHITE) ? 'R' : 'r');
+    }
+    else if (flags == MOVE_QUEEN_CASTLE) {
+        setSquare(board, to - 2, '0');
+        setSquare(board, to + 1, (us == WHITE) ? 'R' : 'r');
+    }
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 7, 0, 'r');
-        setGridItem(board, 6, 0, '0');
-        setGridItem(board, 5, 0, '0');
-        setGridItem(board, 4, 0, 'k');
-        return false;
+    if (pieceType(piece) == KING) {
+        board->kingSquare[us] = to;
     }
-    setGridItem(board, 4, 7, '0');
-    setGridItem(board, 5, 7, 'K');
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 7, 0, 'r');
-        setGridItem(board, 6, 0, '0');
-        setGridItem(board, 5, 0, '0');
-        setGridItem(board, 4, 0, 'k');
-        return false;
+    board->castleRights &= castleMask(from) & castleMask(to);
+    board->reversiblePlies = (board->halfmoveClock == 0 || board->castleRights != record->castleRights) ? 0 : board->reversiblePlies + 1;
+    // Only a pawn that has just double-stepped can be taken En Passant, and only on the next turn.
+    board->enPassant = (flags == MOVE_DOUBLE_STEP) ? to : OFF_BOARD;
+    // The turn passes, along with its key, even when the rule checks try a move for the side that isn't on turn.
+    board->side ^= 1;
+    board->key ^= zobristCastle[board->castleRights] ^ enPassantKey(board);
+}
+
+// Take back the last move made on the board.
+void unmakeMove(struct chessBoard* board) {
+    struct undoRecord* record = &board->history[--board->historyCount];
+    int from = MOVE_FROM(record->move);
+    int to = MOVE_TO(record->move);
+    int flags = MOVE_FLAGS(record->move);
+    int us = pieceColor(record->piece);
+
+    if (flags == MOVE_KING_CASTLE) {
+        setSquare(board, to - 1, '0');
+        setSquare(board, to + 1, (us == WHITE) ? 'R' : 'r');
+    }
+    else if (flags == MOVE_QUEEN_CASTLE) {
+        setSquare(board, to + 1, '0');
+        setSquare(board, to - 2, (us == WHITE) ? 'R' : 'r');
     }
-    setGridItem(board, 5, 0, '0');
-    setGridItem(board, 6, 0, 'K');
 
-    if (kingPassiveCheck(board, turn)) {
-        setGridItem(board, 7, 0, 'r');
-        setGridItem(board, 6, 0, '0');
-        setGridItem(board, 5, 0, '0');
-        setGridItem(board, 4, 0, 'k');
-        return false;
+    if (flags == MOVE_EN_PASSANT) {
+        setSquare(board, to, '0');
+        setSquare(board, (from / BOARD_SIZE) * BOARD_SIZE + to % BOARD_SIZE, record->captured);
+    }
+    else {
+        setSquare(board, to, record->captured);
     }
+    setSquare(board, from, record->piece);
+
+    board->castleRights = record->castleRights;
+    board->enPassant = record->enPassant;
+    board->key = board->keyHistory[board->historyCount];
+    board->halfmoveClock = record->halfmoveClock;
+    board->reversiblePlies = record->reversiblePlies;
+    board->kingSquare[WHITE] = record->kingSquare[WHITE];
+    board->kingSquare[BLACK] = record->kingSquare[BLACK];
+    board->side ^= 1;
+}
+
+// Pass the turn without moving, so the search can see what the opponent would do with two moves in a row.
+// It goes on the stack as move 0, which no real move is, and nothing before it counts for repetitions.
+void makeNullMove(struct chessBoard* board) {
+    board->keyHistory[board->historyCount] = board->key;
+    struct undoRecord* record = &board->history[board->historyCount++];
+    record->move = 0;
+    record->piece = '0';
+    record->captured = '0';
+    record->castleRights = board->castleRights;
+    record->enPassant = board->enPassant;
+    record->kingSquare[WHITE] = board->kingSquare[WHITE];
+    record->kingSquare[BLACK] = board->kingSquare[BLACK];
+    record->halfmoveClock = board->halfmoveClock;
+    record->reversiblePlies = board->reversiblePlies;
+
+    board->key ^= enPassantKey(board) ^ zobristSide;
+    board->enPassant = OFF_BOARD;
+    board->halfmoveClock++;
+    board->reversiblePlies = 0;
+    board->side ^= 1;
+}
+
+// Take back a null move.
+void unmakeNullMove(struct chessBoard* board) {
+    struct undoRecord* record = &board->history[--board->historyCount];
+
+    board->enPassant = record->enPassant;
+    board->key = board->keyHistory[board->historyCount];
+    board->halfmoveClock = record->halfmoveClock;
+    board->reversiblePlies = record->reversiblePlies;
+    board->side ^= 1;
+}
+
+// Check if the given colour's king is attacked.
+bool kingAttacked(struct chessBoard* board, int color) {
+    return (attackMap(board, color ^ 1) & SQUARE_BIT(board->kingSquare[color])) != 0;
+}
+
+// Check if a move leaves the mover's own king safe.
+bool isLegalMove(struct chessBoard* board, uint16_t move) {
+    int us = pieceColor(board->grid[MOVE_FROM(move)]);
+    makeMove(board, move);
+    bool legal = !kingAttacked(board, us);
+    unmakeMove(board);
+    return legal;
+}
+
+// Header files? Never heard of them.
+bool isAttackLegal(struct chessBoard* board, char piece, int targetX, int targetY, int positionX, int positionY);
+
+// Check if the King will be safe, given a possible movement by the king.
+bool kingActiveCheck(struct chessBoard* board, char pieceKing, int targetX, int targetY, int positionX, int positionY) {
+
+    if (pieceType(pieceKing) != KING) return false;
+
+    int flags = isEmpty(board, targetX, targetY) ? MOVE_QUIET : MOVE_CAPTURE;
+    return isLegalMove(board, MOVE(positionY * BOARD_SIZE + positionX, targetY * BOARD_SIZE + targetX, flags));
+}
+
+// Check if the King can move to a given adjacent tile.
+bool kingMove(struct chessBoard* board, int targetX, int targetY, int positionX, int positionY) {
     
-    setGridItem(board, 7, 0, 'r');
-    setGridItem(board, 6, 0, '0');
-    setGridItem(board, 5, 0, '0');
-    setGridItem(board, 4, 0, 'k');
-    return true;
+    char pieceKing = getGridItem(board, positionX, positionY);
+    
+    // For any adjacent tile, detect if the King will be in check.
+    if (kingAttacks[positionY * BOARD_SIZE + positionX] & SQUARE_BIT(targetY * BOARD_SIZE + targetX)) {
+        return kingActiveCheck(board, pieceKing, targetX, targetY, positionX, positionY);
+    }
+    else {
+        return false;
+    }
+}
+
+// Segmentation fault. Probably the use of nested for-loops that end up chaining isAttackLegal()
+
+// Detect check, given a player.
+// char detectCheck(char* board, char pieceMove, int targetX, int targetY, int positionX, int positionY, char turn) {
+
+//     char pieceAtTarget = getGridItem(board, targetX, targetY);
+//     setGridItem(board, targetX, targetY, pieceMove);
+//     setGridItem(board, positionX, positionY, pieceAtTarget);
+
+//     for (int y = 0; y < BOARD_SIZE; y++) {
+//         for (int x = 0; x < BOARD_SIZE; x++) {
+//             if (getGridItem(board, x, y) == 'k') {
+//                 if (kingPassiveCheck(board, turn)) {
+//                     setGridItem(board, targetX, targetY, pieceAtTarget);
+//                     setGridItem(board, positionX, positionY, pieceMove);
+//                     return 'k';
+                    
+//                 }
+//             }
+//             else if (getGridItem(board, x, y) == 'K') {
+//                 if (kingPassiveCheck(board, turn)) {
+//                     setGridItem(board, targetX, targetY, pieceAtTarget);
+//                     setGridItem(board, positionX, positionY, pieceMove);
+//                     return 'K';
+//                 }
+//             }
+//         }
+//     }
+
+//     setGridItem(board, targetX, targetY, pieceAtTarget);
+//     setGridItem(board, positionX, positionY, pieceMove);
+//     return '.';
+// }
+
+// Special helper function for Castling. The king may not start on, cross or land on an attacked square.
+bool isQueensideCastleWhiteLegal(struct chessBoard* board) {
+    return !(attackMap(board, BLACK) & (SQUARE_BIT(60) | SQUARE_BIT(59) | SQUARE_BIT(58)));
+}
+
+// Special helper function for Castling.
+bool isKingsideCastleWhiteLegal(struct chessBoard* board) {
+    return !(attackMap(board, BLACK) & (SQUARE_BIT(60) | SQUARE_BIT(61) | SQUARE_BIT(62)));
+}
+
+// Special helper function for Castling.
+bool isQueensideCastleBlackLegal(struct chessBoard* board) {
+    return !(attackMap(board, WHITE) & (SQUARE_BIT(4) | SQUARE_BIT(3) | SQUARE_BIT(2)));
+}
+
+// Special helper function for Castling.
+bool isKingsideCastleBlackLegal(struct chessBoard* board) {
+    return !(attackMap(board, WHITE) & (SQUARE_BIT(4) | SQUARE_BIT(5) | SQUARE_BIT(6)));
 }
 
 // Check if movement is legal for a given piece, given its position and a target location.
-bool isMoveLegal(char* board, char piece, int targetX, int targetY, int positionX, int positionY, char turn) {
+bool isMoveLegal(struct chessBoard* board, char piece, int targetX, int targetY, int positionX, int positionY) {
 
     char targetPiece = getGridItem(board, targetX, targetY);
     bool friendlyPiece = checkNotFriendlyTarget(targetPiece, piece);
     if (friendlyPiece) return false;
 
     switch(piece) {
-        case 'e': // Double-Step Pawn Black
-            if (isEmpty(board, targetX,  targetY)) {
-                if (positionY == 1) {
-                    return ((targetY + -1 == positionY && positionX == targetX) ||
-                                (targetY + -2 == positionY && positionX == targetX &&
-                                    isEmpty(board, targetX, targetY - 1)));
-                }
-                else {
-                    return (targetY + -1 == positionY && positionX == targetX);
-                }
-            }
-        case 'E': // Double-Step Pawn White
-            if (isEmpty(board, targetX, targetY)) {
-                if (positionY == 6) {
-                    return ((targetY + 1 == positionY && positionX == targetX) ||
-                                (targetY + 2 == positionY && positionX == targetX &&
-                                    isEmpty(board, targetX, targetY + 1)));
-                }
-                else {
-                    return (targetY + 1 == positionY && positionX == targetX);
-                }
-            }
-        case 'p':
-        case 'a': // En Passant Black
-            if (isEmpty(board, targetX, targetY)) {
-                return (targetY - 1 == positionY && positionX == targetX);
+        case 'p': // Pawn Black, which can double-step from its starting row
+            if (isEmpty(board, targetX, targetY) && positionX == targetX) {
+                return (targetY - 1 == positionY) ||
+                    (positionY == 1 && targetY - 2 == positionY && isEmpty(board, targetX, targetY - 1));
             }
             else {
                 return false;
             }
-        case 'P': // Pawn White
-        case 'A': // En Passant White
-            if (isEmpty(board, targetX, targetY)) {
-                return (targetY + 1 == positionY && positionX == targetX);
+        case 'P': // Pawn White, which can double-step from its starting row
+            if (isEmpty(board, targetX, targetY) && positionX == targetX) {
+                return (targetY + 1 == positionY) ||
+                    (positionY == 6 && targetY + 2 == positionY && isEmpty(board, targetX, targetY + 1));
             }
             else {
                 return false;
@@ -839,215 +1493,2268 @@ bool isMoveLegal(char* board, char piece, int targetX, int targetY, int position
             return rookMove(board, targetX, targetY, positionX, positionY);
         case 'n': // Rook Black
         case 'N': // Rook White
-            return knightMove(board, targetX, targetY, positionX, positionY);
+            return knightMove(targetX, targetY, positionX, positionY);
         case 'q':
         case 'Q':
             return ((rookMove(board, targetX, targetY, positionX, positionY)) || (bishopMove(board, targetX, targetY, positionX, positionY)));
         case 'k':
         case 'K':
-            return kingMove(board, piece, targetX, targetY, positionX, positionY, turn);
+            return kingMove(board, targetX, targetY, positionX, positionY);
         default: // Corrupt
             return false;
     }
 }
 
-// Check if attacking is legal for a given piece, given its position and a target location.
-bool isAttackLegal(char* board, char piece, int targetX, int targetY, int positionX, int positionY, char turn) {
-    
-    char targetPiece = getGridItem(board, targetX, targetY);
-    bool friendlyPiece = checkNotFriendlyTarget(targetPiece, piece);
-    bool targetEmpty = isEmpty(board, targetX, targetY);
-    
-    bool whitePassant = getGridItem(board, targetX, targetY + 1) == 'a';
-    bool blackPassant = getGridItem(board, targetX, targetY - 1) == 'A';
+// Check if attacking is legal for a given piece, given its position and a target location.
+bool isAttackLegal(struct chessBoard* board, char piece, int targetX, int targetY, int positionX, int positionY) {
+    
+    char targetPiece = getGridItem(board, targetX, targetY);
+    bool friendlyPiece = checkNotFriendlyTarget(targetPiece, piece);
+    bool targetEmpty = isEmpty(board, targetX, targetY);
+    
+    // A pawn that has just double-stepped can be taken by moving behind it.
+    int passant = board->enPassant;
+    bool whitePassant = passant != OFF_BOARD && passant == (targetY + 1) * BOARD_SIZE + targetX && pieceColor(board->grid[passant]) == BLACK;
+    bool blackPassant = passant != OFF_BOARD && passant == (targetY - 1) * BOARD_SIZE + targetX && pieceColor(board->grid[passant]) == WHITE;
+
+    if (friendlyPiece) return false;
+    
+    if (isEmpty(board, targetX, targetY)) {
+        if (piece == 'P') {
+            if (positionY == 3 && whitePassant && abs(targetX - positionX) == 1) {
+                return true;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (piece == 'p') {
+            if (positionY == 4 && blackPassant && abs(targetX - positionX) == 1) {
+                return true;
+            }
+            else {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    switch (piece) {
+        case 'P': // Pawn White
+            return (targetY + 1 == positionY && abs(targetX - positionX) == 1);
+            break;
+        case 'p': // Pawn Black
+            return (targetY - 1 == positionY && abs(targetX - positionX) == 1);
+            break;
+        case 'B': // Bishop Black
+        case 'b': // Bishop White
+            return bishopAttack(board, positionX, positionY, targetX, targetY);
+            break;
+        case 'R': // Rook White
+        case 'r': // Rook Black
+            return rookAttack(board, positionX, positionY, targetX, targetY);
+            break;
+        case 'Q': // Queen White
+        case 'q': // Queen Black
+            return (bishopAttack(board, positionX, positionY, targetX, targetY) || rookAttack(board, positionX, positionY, targetX, targetY));
+            break;
+        case 'K':
+        case 'k':
+            return kingMove(board, targetX, targetY, positionX, positionY);
+        case 'N':
+        case 'n':
+            return knightMove(targetX, targetY, positionX, positionY);
+        default:
+            return false;
+    }
+}
+
+// Check if castling is legal for a rook or a king, given its position and a target location.
+bool isCastleLegal(struct chessBoard* board, char castlePiece, int targetX, int targetY, int positionX, int positionY, char turn) {
+
+    bool rookSelectedQCW = false;
+    bool rookSelectedKCW = false;
+    bool rookSelectedQCB = false;
+    bool rookSelectedKCB = false;
+
+    if (castlePiece == 'R') {
+        if (positionX == 7 && positionY == 7) {
+            rookSelectedKCW = true;
+        }
+        else if (positionX == 0 && positionY == 7) {
+            rookSelectedQCW = true;
+        }
+    }
+    else if (castlePiece == 'r') {
+        if (positionX == 0 && positionY == 0) {
+            rookSelectedQCB = true;
+        }
+        else if (positionX == 7 && positionY == 0) {
+            rookSelectedKCB = true;
+        }
+    }
+
+    if (whoseTurn(castlePiece) == turn) {
+        switch(castlePiece) {
+            case 'R':
+                if (rookSelectedQCW && (board->castleRights & CASTLE_WHITE_QUEENSIDE)) {
+                    if (isEmpty(board, 1, 7) && isEmpty(board, 2, 7) && isEmpty(board, 3, 7)) {
+                        if (targetX == 3 && targetY == 7 && isQueensideCastleWhiteLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                else if (rookSelectedKCW && (board->castleRights & CASTLE_WHITE_KINGSIDE)) {
+                    if (isEmpty(board, 6, 7) && isEmpty(board, 5, 7)) {
+                        if (targetX == 5 && targetY == 7 && isKingsideCastleWhiteLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            case 'r':
+                if (rookSelectedQCB && (board->castleRights & CASTLE_BLACK_QUEENSIDE)) {
+                    if (isEmpty(board, 1, 0) && isEmpty(board, 2, 0) && isEmpty(board, 3, 0)) {
+                        if (targetX == 3 && targetY == 0 && isQueensideCastleBlackLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                else if (rookSelectedKCB && (board->castleRights & CASTLE_BLACK_KINGSIDE)) {
+                    if (isEmpty(board, 6, 0) && isEmpty(board, 5, 0)) {
+                        if (targetX == 5 && targetY == 0 && isKingsideCastleBlackLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            case 'K':
+                if (board->castleRights & CASTLE_WHITE_QUEENSIDE) {
+                    if (isEmpty(board, 1, 7) && isEmpty(board, 2, 7) && isEmpty(board, 3, 7)) {
+                        if (targetX == 2 && targetY == 7 && isQueensideCastleWhiteLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                if (board->castleRights & CASTLE_WHITE_KINGSIDE) {
+                    if (isEmpty(board, 6, 7) && isEmpty(board, 5, 7)) {
+                        if (targetX == 6 && targetY == 7 && isKingsideCastleWhiteLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            case 'k':
+                if (board->castleRights & CASTLE_BLACK_QUEENSIDE) {
+                    if (isEmpty(board, 1, 0) && isEmpty(board, 2, 0) && isEmpty(board, 3, 0)) {
+                        if (targetX == 2 && targetY == 0 && isQueensideCastleBlackLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                if (board->castleRights & CASTLE_BLACK_KINGSIDE) {
+                    if (isEmpty(board, 6, 0) && isEmpty(board, 5, 0)) {
+                        if (targetX == 6 && targetY == 0 && isKingsideCastleBlackLegal(board)) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+// Add one move per target square, all from the same square.
+void addMoves(struct moveList* list, int from, uint64_t targets, uint64_t enemies) {
+    while (targets) {
+        int to = __builtin_ctzll(targets);
+        targets &= targets - 1;
+        list->moves[list->count++] = MOVE(from, to, (enemies & SQUARE_BIT(to)) ? MOVE_CAPTURE : MOVE_QUIET);
+    }
+}
+
+// Add a pawn move, expanding it into the four promotions when it reaches the last row.
+void addPawnMove(struct moveList* list, int from, int to, int flags) {
+    if (to < BOARD_SIZE || to >= BOARD_SIZE * (BOARD_SIZE - 1)) {
+        for (int promotion = 0; promotion < 4; promotion++) {
+            list->moves[list->count++] = MOVE(from, to, flags | MOVE_PROMOTION | promotion);
+        }
+    }
+    else {
+        list->moves[list->count++] = MOVE(from, to, flags);
+    }
+}
+
+// The castling move to the given side for the side to move, or 0 if it isn't allowed now. Castling needs the right,
+// an empty path and a king that neither starts in nor passes through check. Whether the landing square is attacked
+// is left to the same filter as every other king move.
+uint16_t castlingMove(struct chessBoard* board, bool kingside) {
+    int us = board->side;
+    int homeRow = (us == WHITE) ? 7 * BOARD_SIZE : 0;
+    uint64_t king = board->pieces[us][KING];
+    uint64_t rooks = board->pieces[us][ROOK];
+
+    if (kingside) {
+        int right = (us == WHITE) ? CASTLE_WHITE_KINGSIDE : CASTLE_BLACK_KINGSIDE;
+        if ((board->castleRights & right) && (king & SQUARE_BIT(homeRow + 4)) && (rooks & SQUARE_BIT(homeRow + 7))
+            && !(board->occupied & (SQUARE_BIT(homeRow + 5) | SQUARE_BIT(homeRow + 6)))
+            && !(attackMap(board, us ^ 1) & (SQUARE_BIT(homeRow + 4) | SQUARE_BIT(homeRow + 5)))) {
+            return MOVE(homeRow + 4, homeRow + 6, MOVE_KING_CASTLE);
+        }
+    }
+    else {
+        int right = (us == WHITE) ? CASTLE_WHITE_QUEENSIDE : CASTLE_BLACK_QUEENSIDE;
+        if ((board->castleRights & right) && (king & SQUARE_BIT(homeRow + 4)) && (rooks & SQUARE_BIT(homeRow))
+            && !(board->occupied & (SQUARE_BIT(homeRow + 1) | SQUARE_BIT(homeRow + 2) | SQUARE_BIT(homeRow + 3)))
+            && !(attackMap(board, us ^ 1) & (SQUARE_BIT(homeRow + 4) | SQUARE_BIT(homeRow + 3)))) {
+            return MOVE(homeRow + 4, homeRow + 2, MOVE_QUEEN_CASTLE);
+        }
+    }
+    return 0;
+}
+
+// Add the moves that change the material for the side to move: captures, En Passant and promotions.
+// A capture is a move onto a square an enemy piece stands on, the same rule isAttackLegal checks targets by.
+void addCaptures(struct chessBoard* board, struct moveList* list) {
+    int us = board->side;
+    int them = us ^ 1;
+    uint64_t enemies = board->colors[them];
+    uint64_t empty = ~board->occupied;
+    uint64_t pieces;
+
+    // White pawns advance towards row 0, Black pawns towards row 7.
+    int forward = (us == WHITE) ? -BOARD_SIZE : BOARD_SIZE;
+    uint64_t lastRows = 0xFFULL | (0xFFULL << 56);
+
+    pieces = board->pieces[us][PAWN];
+    while (pieces) {
+        int from = __builtin_ctzll(pieces);
+        int to = from + forward;
+        pieces &= pieces - 1;
+
+        if ((empty & lastRows) & SQUARE_BIT(to)) {
+            addPawnMove(list, from, to, MOVE_QUIET);
+        }
+
+        uint64_t captures = pawnAttacks[us][from] & enemies;
+        while (captures) {
+            addPawnMove(list, from, __builtin_ctzll(captures), MOVE_CAPTURE);
+            captures &= captures - 1;
+        }
+    }
+
+    // A pawn that has just double-stepped can be taken from the side on the next turn.
+    if (board->enPassant != OFF_BOARD) {
+        int target = board->enPassant + forward;
+        uint64_t takers = pawnAttacks[them][target] & board->pieces[us][PAWN];
+        while (takers) {
+            list->moves[list->count++] = MOVE(__builtin_ctzll(takers), target, MOVE_EN_PASSANT);
+            takers &= takers - 1;
+        }
+    }
+
+    // Every other piece already has its attacks worked out on the board.
+    for (pieces = board->colors[us] & ~board->pieces[us][PAWN]; pieces; pieces &= pieces - 1) {
+        int from = __builtin_ctzll(pieces);
+        addMoves(list, from, board->attacks[from] & enemies, enemies);
+    }
+}
+
+// Add the moves that leave the material as it is: pawn pushes short of the last row, double steps,
+// other pieces' moves to empty squares, and castling.
+void addQuietMoves(struct chessBoard* board, struct moveList* list) {
+    int us = board->side;
+    uint64_t empty = ~board->occupied;
+    uint64_t pieces;
+
+    // White pawns advance towards row 0 and double-step from row 6, Black the other way from row 1.
+    int forward = (us == WHITE) ? -BOARD_SIZE : BOARD_SIZE;
+    uint64_t startRow = (us == WHITE) ? 0xFFULL << 48 : 0xFFULL << 8;
+    uint64_t lastRows = 0xFFULL | (0xFFULL << 56);
+
+    pieces = board->pieces[us][PAWN];
+    while (pieces) {
+        int from = __builtin_ctzll(pieces);
+        int to = from + forward;
+        pieces &= pieces - 1;
+
+        if ((empty & ~lastRows) & SQUARE_BIT(to)) {
+            list->moves[list->count++] = MOVE(from, to, MOVE_QUIET);
+            if ((startRow & SQUARE_BIT(from)) && (empty & SQUARE_BIT(to + forward))) {
+                list->moves[list->count++] = MOVE(from, to + forward, MOVE_DOUBLE_STEP);
+            }
+        }
+    }
+
+    for (pieces = board->colors[us] & ~board->pieces[us][PAWN]; pieces; pieces &= pieces - 1) {
+        int from = __builtin_ctzll(pieces);
+        addMoves(list, from, board->attacks[from] & empty, 0);
+    }
+
+    uint16_t castle = castlingMove(board, true);
+    if (castle) list->moves[list->count++] = castle;
+    castle = castlingMove(board, false);
+    if (castle) list->moves[list->count++] = castle;
+}
+
+// Fill the list with every pseudo-legal move for the side to move, captures first.
+// Moves that leave the king attacked are included and have to be filtered by the caller.
+void generateMoves(struct chessBoard* board, struct moveList* list) {
+    list->count = 0;
+    addCaptures(board, list);
+    addQuietMoves(board, list);
+}
+
+// Check that a move, perhaps one remembered from another position, is one generateMoves would give here,
+// without generating anything.
+bool isPseudoLegal(struct chessBoard* board, uint16_t move) {
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int flags = MOVE_FLAGS(move);
+    int us = board->side;
+    char piece = board->grid[from];
+    char target = board->grid[to];
+
+    if (move == 0 || pieceType(piece) == NO_PIECE || pieceColor(piece) != us) return false;
+
+    if (flags == MOVE_KING_CASTLE || flags == MOVE_QUEEN_CASTLE) {
+        return castlingMove(board, flags == MOVE_KING_CASTLE) == move;
+    }
+
+    // Apart from En Passant, the capture flag has to match what stands on the target.
+    bool capture = (pieceType(target) != NO_PIECE);
+    if (capture && pieceColor(target) == us) return false;
+    if (flags != MOVE_EN_PASSANT && capture != (MOVE_IS_CAPTURE(move) != 0)) return false;
+
+    if (pieceType(piece) != PAWN) {
+        return (flags == MOVE_QUIET || flags == MOVE_CAPTURE) && (board->attacks[from] & SQUARE_BIT(to));
+    }
+
+    int forward = (us == WHITE) ? -BOARD_SIZE : BOARD_SIZE;
+    bool lastRow = (to < BOARD_SIZE || to >= BOARD_SIZE * (BOARD_SIZE - 1));
+
+    if (flags == MOVE_EN_PASSANT) {
+        return board->enPassant != OFF_BOARD && to == board->enPassant + forward && (pawnAttacks[us][from] & SQUARE_BIT(to));
+    }
+    if (flags == MOVE_DOUBLE_STEP) {
+        uint64_t startRow = (us == WHITE) ? 0xFFULL << 48 : 0xFFULL << 8;
+        return (startRow & SQUARE_BIT(from)) && to == from + 2 * forward && !(board->occupied & (SQUARE_BIT(from + forward) | SQUARE_BIT(to)));
+    }
+    if (lastRow != (MOVE_IS_PROMOTION(move) != 0)) return false;
+    if (!MOVE_IS_PROMOTION(move) && flags != MOVE_QUIET && flags != MOVE_CAPTURE) return false;
+    return capture ? (pawnAttacks[us][from] & SQUARE_BIT(to)) != 0 : to == from + forward;
+}
+
+// Fill the list with only the moves that leave the mover's king safe.
+void generateLegalMoves(struct chessBoard* board, struct moveList* list) {
+    struct moveList pseudo;
+    generateMoves(board, &pseudo);
+
+    list->count = 0;
+    for (int i = 0; i < pseudo.count; i++) {
+        if (isLegalMove(board, pseudo.moves[i])) list->moves[list->count++] = pseudo.moves[i];
+    }
+}
+
+// Check if the side to move has any legal move, stopping at the first one found.
+bool hasLegalMove(struct chessBoard* board) {
+    struct moveList pseudo;
+    generateMoves(board, &pseudo);
+
+    for (int i = 0; i < pseudo.count; i++) {
+        if (isLegalMove(board, pseudo.moves[i])) return true;
+    }
+
+    return false;
+}
+
+// Check if neither side has the material left to mate: bare kings, a single minor piece, or only bishops on one colour of square.
+bool insufficientMaterial(struct chessBoard* board) {
+    const uint64_t lightSquares = 0xAA55AA55AA55AA55ULL;
+    uint64_t heavy = 0;
+    uint64_t knights = board->pieces[WHITE][KNIGHT] | board->pieces[BLACK][KNIGHT];
+    uint64_t bishops = board->pieces[WHITE][BISHOP] | board->pieces[BLACK][BISHOP];
+
+    for (int color = WHITE; color <= BLACK; color++) {
+        heavy |= board->pieces[color][PAWN] | board->pieces[color][ROOK] | board->pieces[color][QUEEN];
+    }
+
+    if (heavy) return false;
+    if (__builtin_popcountll(knights | bishops) <= 1) return true;
+    return knights == 0 && ((bishops & lightSquares) == 0 || (bishops & ~lightSquares) == 0);
+}
+
+// Check if the position has already been seen the given number of times. Only positions since the last
+// irreversible move can repeat, and only every other one has the same side to move, the nearest four plies back.
+bool isRepetition(struct chessBoard* board, int times) {
+    int reversible = (board->reversiblePlies < board->historyCount) ? board->reversiblePlies : board->historyCount;
+    int oldest = board->historyCount - reversible;
+
+    for (int ply = board->historyCount - 4; ply >= oldest; ply -= 2) {
+        if (board->keyHistory[ply] == board->key && --times == 0) return true;
+    }
+
+    return false;
+}
+
+// How a game stands after a move.
+#define GAME_ONGOING 0
+#define GAME_CHECKMATE 1
+#define GAME_STALEMATE 2
+#define GAME_INSUFFICIENT_MATERIAL 3
+#define GAME_REPETITION 4
+#define GAME_FIFTY_MOVES 5
+#define GAME_MOVE_LIMIT 6 // The board's move stack is full, short of the room a search needs.
+
+// Work out whether the game is over for the side to move, and why.
+int gameResult(struct chessBoard* board) {
+    if (!hasLegalMove(board)) {
+        return kingAttacked(board, board->side) ? GAME_CHECKMATE : GAME_STALEMATE;
+    }
+    if (insufficientMaterial(board)) return GAME_INSUFFICIENT_MATERIAL;
+    if (board->halfmoveClock >= 100) return GAME_FIFTY_MOVES;
+    if (isRepetition(board, 2)) return GAME_REPETITION;
+
+    return GAME_ONGOING;
+}
+
+// Write a move in coordinate notation, e.g. e2e4 or e7e8q.
+void moveToString(uint16_t move, char* out) {
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+
+    out[0] = 'a' + from % BOARD_SIZE;
+    out[1] = '8' - from / BOARD_SIZE;
+    out[2] = 'a' + to % BOARD_SIZE;
+    out[3] = '8' - to / BOARD_SIZE;
+    out[4] = MOVE_IS_PROMOTION(move) ? "nbrq"[MOVE_PROMOTION_TYPE(move) - KNIGHT] : '\0';
+    out[5] = '\0';
+}
+
+// Find the legal move written in coordinate notation, or 0 if there is none. Any whitespace,
+// including the carriage return of a CRLF line, ends the move like the end of the text does.
+uint16_t parseMove(struct chessBoard* board, const char* text) {
+    struct moveList legal;
+    generateLegalMoves(board, &legal);
+
+    for (int i = 0; i < legal.count; i++) {
+        char move[6];
+        moveToString(legal.moves[i], move);
+        if (strncmp(move, text, 4) == 0 && move[4] == ((strchr(" \t\r\n", text[4]) != NULL) ? '\0' : text[4])) {
+            return legal.moves[i];
+        }
+    }
+
+    return 0;
+}
+
+// Check if a character ends a FEN field, so FENs can be read straight out of a buffer of lines.
+bool fenFieldEnd(char c) {
+    return c == '\0' || c == ' ' || c == '\n' || c == '\r';
+}
+
+// Largest move counter read from a FEN. Larger ones are read as this, so they can't overflow.
+#define MAX_FEN_COUNTER 9999
+
+// Read a move counter from a FEN, leaving the fallback if the field is missing.
+const char* readFenNumber(const char* fen, int* value, int fallback) {
+    while (*fen == ' ') fen++;
+    *value = fallback;
+    if (*fen >= '0' && *fen <= '9') {
+        *value = 0;
+        while (*fen >= '0' && *fen <= '9') {
+            *value = *value * 10 + *fen++ - '0';
+            if (*value > MAX_FEN_COUNTER) *value = MAX_FEN_COUNTER;
+        }
+    }
+    return fen;
+}
+
+// Empty the board of pieces, castling rights and moves, ready for a position to be set up square by square.
+void clearBoard(struct chessBoard* board) {
+    memset(board->pieces, 0, sizeof(board->pieces));
+    memset(board->colors, 0, sizeof(board->colors));
+    memset(board->grid, '0', sizeof(board->grid));
+    board->score = 0;
+    board->phase = 0;
+    board->pawnKey = 0;
+    board->accumulatorVersion = 0;
+    board->castleRights = 0;
+    board->enPassant = OFF_BOARD;
+    board->reversiblePlies = 0;
+    board->historyCount = 0;
+}
+
+// Put a piece on an empty square while a position is being set up.
+void placePiece(struct chessBoard* board, int square, char piece) {
+    int color = pieceColor(piece);
+
+    board->grid[square] = piece;
+    board->score += pieceSquareScore(piece, square);
+    board->phase += phaseWeights[pieceType(piece)];
+    if (pieceType(piece) == PAWN) board->pawnKey ^= zobristPieces[color][PAWN][square];
+    board->pieces[color][pieceType(piece)] |= SQUARE_BIT(square);
+    board->colors[color] |= SQUARE_BIT(square);
+}
+
+// Work out the occupancy and every piece's attacks once all the pieces of a new position are in place,
+// instead of square by square as they are placed.
+void finishPlacement(struct chessBoard* board) {
+    board->occupied = board->colors[WHITE] | board->colors[BLACK];
+
+    memset(board->attacks, 0, sizeof(board->attacks));
+    for (uint64_t pieces = board->occupied; pieces; pieces &= pieces - 1) {
+        int square = __builtin_ctzll(pieces);
+        board->attacks[square] = pieceAttacks(board->grid[square], square, board->occupied);
+    }
+    board->attackMapsStale = true;
+}
+
+// Load a position in Forsyth-Edwards Notation onto the board.
+// The FEN ends at the end of the string or of its line, and everything after the side to move may be left off.
+// Nothing is allocated and the board's move stack is not touched, so large FEN files can be read quickly.
+bool loadFen(struct chessBoard* board, const char* fen) {
+    clearBoard(board);
+
+    int x = 0;
+    int y = 0;
+    for (; !fenFieldEnd(*fen); fen++) {
+        if (*fen == '/') {
+            if (x != BOARD_SIZE) return false;
+            x = 0;
+            y++;
+        }
+        else if (*fen >= '1' && *fen <= '8') {
+            x += *fen - '0';
+        }
+        else if (pieceType(*fen) != NO_PIECE && x < BOARD_SIZE && y < BOARD_SIZE) {
+            placePiece(board, y * BOARD_SIZE + x, *fen);
+            x++;
+        }
+        else {
+            return false;
+        }
+    }
+    if (x != BOARD_SIZE || y != BOARD_SIZE - 1) return false;
+    if (__builtin_popcountll(board->pieces[WHITE][KING]) != 1 || __builtin_popcountll(board->pieces[BLACK][KING]) != 1) return false;
+    // A pawn on the first or last row could never have got there, and has no squares to move or attack from it.
+    if ((board->pieces[WHITE][PAWN] | board->pieces[BLACK][PAWN]) & 0xFF000000000000FFULL) return false;
+    board->kingSquare[WHITE] = __builtin_ctzll(board->pieces[WHITE][KING]);
+    board->kingSquare[BLACK] = __builtin_ctzll(board->pieces[BLACK][KING]);
+    finishPlacement(board);
+
+    while (*fen == ' ') fen++;
+    if (*fen == 'w') board->side = WHITE;
+    else if (*fen == 'b') board->side = BLACK;
+    else return false;
+    fen++;
+
+    // The side that just moved can't have left its king in check, or the king could be taken.
+    if (kingAttacked(board, board->side ^ 1)) return false;
+
+    while (*fen == ' ') fen++;
+    for (; !fenFieldEnd(*fen); fen++) {
+        switch(*fen) {
+            case 'K':
+                board->castleRights |= CASTLE_WHITE_KINGSIDE;
+                break;
+            case 'Q':
+                board->castleRights |= CASTLE_WHITE_QUEENSIDE;
+                break;
+            case 'k':
+                board->castleRights |= CASTLE_BLACK_KINGSIDE;
+                break;
+            case 'q':
+                board->castleRights |= CASTLE_BLACK_QUEENSIDE;
+                break;
+            case '-':
+                break;
+            default:
+                return false;
+        }
+    }
+
+    // The En Passant target is the square behind the pawn that just double-stepped.
+    while (*fen == ' ') fen++;
+    if (fen[0] >= 'a' && fen[0] <= 'h' && (fen[1] == '3' || fen[1] == '6')) {
+        int passantX = fen[0] - 'a';
+        int passantY = (fen[1] == '3') ? 4 : 3;
+        int square = passantY * BOARD_SIZE + passantX;
+        if (pieceType(board->grid[square]) == PAWN && pieceColor(board->grid[square]) != board->side) {
+            board->enPassant = square;
+        }
+    }
+    while (!fenFieldEnd(*fen)) fen++;
+
+    // The move counters: plies since the last capture or pawn move, and the number of the full move.
+    int fullmove;
+    fen = readFenNumber(fen, &board->halfmoveClock, 0);
+    readFenNumber(fen, &fullmove, 1);
+    board->startPly = 2 * ((fullmove > 0) ? fullmove - 1 : 0) + board->side;
+
+    board->key = computeKey(board);
+    return true;
+}
+
+// Longest FEN writeFen can produce, with its terminating null: 71 characters for the squares,
+// 10 for the side, castling and En Passant fields, and 12 for each counter at any int value.
+#define MAX_FEN_LENGTH 106
+
+// Write the board's position as a FEN into out, which must hold MAX_FEN_LENGTH characters.
+// Returns the length written.
+int writeFen(struct chessBoard* board, char* out) {
+    const char fenPieces[2][6] = {{'P', 'N', 'B', 'R', 'Q', 'K'}, {'p', 'n', 'b', 'r', 'q', 'k'}};
+    char* start = out;
+
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        int empty = 0;
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            char item = board->grid[y * BOARD_SIZE + x];
+            if (pieceType(item) == NO_PIECE) {
+                empty++;
+                continue;
+            }
+            if (empty > 0) *out++ = '0' + empty;
+            empty = 0;
+            *out++ = fenPieces[pieceColor(item)][pieceType(item)];
+        }
+        if (empty > 0) *out++ = '0' + empty;
+        if (y < BOARD_SIZE - 1) *out++ = '/';
+    }
+
+    *out++ = ' ';
+    *out++ = (board->side == WHITE) ? 'w' : 'b';
+    *out++ = ' ';
+    if (board->castleRights == 0) *out++ = '-';
+    if (board->castleRights & CASTLE_WHITE_KINGSIDE) *out++ = 'K';
+    if (board->castleRights & CASTLE_WHITE_QUEENSIDE) *out++ = 'Q';
+    if (board->castleRights & CASTLE_BLACK_KINGSIDE) *out++ = 'k';
+    if (board->castleRights & CASTLE_BLACK_QUEENSIDE) *out++ = 'q';
+    *out++ = ' ';
+
+    // The En Passant target is the square the pawn passed over.
+    if (board->enPassant != OFF_BOARD) {
+        int behind = (pieceColor(board->grid[board->enPassant]) == WHITE) ? BOARD_SIZE : -BOARD_SIZE;
+        int target = board->enPassant + behind;
+        *out++ = 'a' + target % BOARD_SIZE;
+        *out++ = '8' - target / BOARD_SIZE;
+    }
+    else {
+        *out++ = '-';
+    }
+
+    int ply = board->startPly + board->historyCount;
+    out += snprintf(out, MAX_FEN_LENGTH - (out - start), " %d %d", board->halfmoveClock, ply / 2 + 1);
+    return out - start;
+}
+
+// Pack the board's position into its compact form.
+void packPosition(struct chessBoard* board, struct position* position) {
+    memset(position->squares, 0, sizeof(position->squares));
+    for (uint64_t pieces = board->occupied; pieces; pieces &= pieces - 1) {
+        int square = __builtin_ctzll(pieces);
+        char item = board->grid[square];
+        position->squares[square / 2] |= (pieceColor(item) * 8 + pieceType(item) + 1) << (4 * (square % 2));
+    }
+
+    position->ply = board->startPly + board->historyCount;
+    position->halfmoveClock = board->halfmoveClock;
+    position->side = board->side;
+    position->castleRights = board->castleRights;
+    position->enPassant = board->enPassant;
+    position->kingSquare[WHITE] = board->kingSquare[WHITE];
+    position->kingSquare[BLACK] = board->kingSquare[BLACK];
+}
+
+// Set the board up from a packed position, with nothing to take back.
+void unpackPosition(struct chessBoard* board, const struct position* position) {
+    const char packedPieces[16] = "0PNBRQK00pnbrqk0";
+
+    clearBoard(board);
+    for (int square = 0; square < BOARD_SIZE * BOARD_SIZE; square++) {
+        int code = (position->squares[square / 2] >> (4 * (square % 2))) & 15;
+        if (code != 0) placePiece(board, square, packedPieces[code]);
+    }
+    finishPlacement(board);
+
+    board->side = position->side;
+    board->castleRights = position->castleRights;
+    board->enPassant = position->enPassant;
+    board->kingSquare[WHITE] = position->kingSquare[WHITE];
+    board->kingSquare[BLACK] = position->kingSquare[BLACK];
+    board->halfmoveClock = position->halfmoveClock;
+    board->startPly = position->ply;
+    board->key = computeKey(board);
+}
+
+// Games held side by side in one block, so a server can keep a very large number of them.
+// Unused games are chained into a free list, so taking and releasing one never allocates.
+struct gamePool
+{
+    struct storedGame* games;
+    int capacity;
+    int firstFree;
+    int used;
+};
+
+// Allocate a pool with room for the given number of games, or return NULL if there isn't the memory.
+struct gamePool* createGamePool(int capacity) {
+    struct gamePool* pool = malloc(sizeof(struct gamePool));
+    if (pool == NULL) return NULL;
+
+    pool->games = malloc((size_t)capacity * sizeof(struct storedGame));
+    if (pool->games == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pool->capacity = capacity;
+    pool->firstFree = (capacity > 0) ? 0 : -1;
+    pool->used = 0;
+
+    for (int i = 0; i < capacity; i++) {
+        pool->games[i].nextFree = (i + 1 < capacity) ? i + 1 : -1;
+    }
+
+    return pool;
+}
+
+// Take an unused game from the pool, or NULL if the pool is full.
+struct storedGame* takeGame(struct gamePool* pool) {
+    if (pool->firstFree < 0) return NULL;
+
+    struct storedGame* game = &pool->games[pool->firstFree];
+    pool->firstFree = game->nextFree;
+    pool->used++;
+    game->nextFree = -1;
+    return game;
+}
+
+// Give a game back to the pool.
+void releaseGame(struct gamePool* pool, struct storedGame* game) {
+    game->nextFree = pool->firstFree;
+    pool->firstFree = game - pool->games;
+    pool->used--;
+}
+
+void freeGamePool(struct gamePool* pool) {
+    if (pool == NULL) return;
+    free(pool->games);
+    free(pool);
+}
+
+// Monotonic wall-clock time in seconds.
+double currentTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// One cached subtree count. The key is stored XORed with the data, so a torn write from
+// another thread fails the key check instead of returning a wrong count.
+struct perftEntry
+{
+    uint64_t check;
+    uint64_t data;
+};
+
+// A fixed-size cache of subtree counts, shared by every perft thread.
+struct perftTable
+{
+    struct perftEntry* entries;
+    uint64_t mask;
+};
+
+// Count the leaf nodes of the legal move tree below a position.
+uint64_t perft(struct chessBoard* board, int depth, struct perftTable* table) {
+    uint64_t key = 0;
+    struct perftEntry* entry = NULL;
+
+    if (table != NULL && depth >= 2) {
+        key = board->key;
+        entry = &table->entries[(key + depth) & table->mask];
+        uint64_t data = entry->data;
+        if ((entry->check ^ data) == key && (int)(data & 0xFF) == depth) {
+            return data >> 8;
+        }
+    }
+
+    struct moveList list;
+    int us = board->side;
+    generateMoves(board, &list);
+
+    uint64_t nodes = 0;
+    for (int i = 0; i < list.count; i++) {
+        makeMove(board, list.moves[i]);
+        if (!kingAttacked(board, us)) {
+            nodes += (depth == 1) ? 1 : perft(board, depth - 1, table);
+        }
+        unmakeMove(board);
+    }
+
+    if (entry != NULL) {
+        uint64_t data = (nodes << 8) | depth;
+        entry->check = key ^ data;
+        entry->data = data;
+    }
+
+    return nodes;
+}
+
+// Root moves shared between the perft worker threads.
+struct perftJob
+{
+    struct chessBoard* board;
+    int depth;
+    struct perftTable* table;
+    uint16_t* moves;
+    uint64_t* counts;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+};
+
+// Take root moves off the job one at a time until none are left, playing them on a private board.
+void* perftWorker(void* argument) {
+    struct perftJob* job = argument;
+    struct chessBoard* board = malloc(sizeof(struct chessBoard));
+    *board = *job->board;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= job->count) break;
+
+        makeMove(board, job->moves[i]);
+        job->counts[i] = (job->depth == 1) ? 1 : perft(board, job->depth - 1, job->table);
+        unmakeMove(board);
+    }
+
+    free(board);
+    return NULL;
+}
+
+// Search limits and score bounds. Mate scores count down with the distance to the mate.
+#define MAX_SEARCH_PLY 64
+#define INFINITE_SCORE 32000
+#define MATE_SCORE 30000
+
+// How often, in nodes, the search looks at the clock and for a request to stop.
+#define TIME_CHECK_NODES 2048
+
+// Sharing out a clock: time kept back on every move for the answer to reach it, the number of moves the time
+// left is spread over when the next time control doesn't say, how many times the time aimed for a move may
+// run to when the search needs it, and the most of the clock one move may ever take.
+#define MOVE_OVERHEAD 0.03
+#define DEFAULT_MOVES_TO_GO 30
+#define HARD_LIMIT_FACTOR 4
+#define HARD_LIMIT_SHARE 0.8
+
+// How much of the time aimed for a move is used, by how many iterations in a row the best move has held.
+const double stabilityScales[5] = {1.6, 1.1, 0.8, 0.6, 0.5};
+
+// How many times longer a search is once its next iteration is done.
+#define ITERATION_GROWTH 2
+
+// Read a stop flag, which another thread may set at any time.
+bool stopFlag(bool* flag) {
+    return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+}
+
+// Set a stop flag for the threads reading it. Whatever was written before is seen by a thread that sees the flag.
+void raiseStopFlag(bool* flag) {
+    __atomic_store_n(flag, true, __ATOMIC_RELEASE);
+}
+
+// Material value of each piece type, indexed by PAWN to KING, used to put the most valuable captures first.
+const int pieceValues[6] = {100, 320, 330, 500, 900, 0};
+
+// Pawn structure terms, each for one pawn.
+#define DOUBLED_PAWN S(-11, -28) // For a pawn with another of its side in front of it.
+#define ISOLATED_PAWN S(-7, -12) // For a pawn with none of its side on the files beside it.
+#define BACKWARD_PAWN S(-6, -14) // For a pawn that no pawn beside it can catch up with, whose next square an enemy pawn guards.
+#define KING_SHIELD_PAWN S(10, 0) // For a pawn in the two rows in front of its king.
+// For a passed pawn, by its row counted from its own side, and again for one with nothing on the square in front of it.
+const int passedPawnBonus[BOARD_SIZE] = {0, S(2, 10), S(4, 16), S(10, 28), S(24, 48), S(45, 80), S(75, 120), 0};
+const int freePassedPawnBonus[BOARD_SIZE] = {0, 0, S(0, 4), S(2, 10), S(5, 18), S(10, 30), S(15, 48), 0};
+
+// How many entries each search thread's pawn structure table has. A power of two.
+#define PAWN_TABLE_SIZE 16384
+
+// The pawn structure terms of one arrangement of pawns, and the passed pawns of each side.
+struct pawnEntry
+{
+    uint64_t key;
+    uint64_t passed[2];
+    int score;
+};
+
+// Pawn structures already worked out by one search thread. The pawns change on few moves, so most
+// evaluations find theirs here. A zeroed entry holds the right answer for the key 0 of no pawns at all.
+struct pawnTable
+{
+    struct pawnEntry entries[PAWN_TABLE_SIZE];
+    uint64_t probes;
+    uint64_t hits;
+};
+
+// Allocate a pawn structure table for each of the given number of search threads, kept from one search to the
+// next like the transposition table. Returns NULL if there isn't the memory, and the pawns are worked out every time.
+struct pawnTable* createPawnTables(int count) {
+    return calloc((count > 1) ? count : 1, sizeof(struct pawnTable));
+}
+
+// Forget every pawn structure in the tables, for a new game.
+void clearPawnTables(struct pawnTable* tables, int count) {
+    if (tables != NULL) memset(tables, 0, ((count > 1) ? count : 1) * sizeof(struct pawnTable));
+}
+
+// Work out the pawn structure terms for White and find the passed pawns, looking at the pawns alone.
+void evaluatePawns(struct chessBoard* board, struct pawnEntry* entry) {
+    entry->score = 0;
+
+    for (int color = WHITE; color <= BLACK; color++) {
+        uint64_t ours = board->pieces[color][PAWN];
+        uint64_t theirs = board->pieces[color ^ 1][PAWN];
+        int score = 0;
+
+        entry->passed[color] = 0;
+        for (uint64_t pawns = ours; pawns; pawns &= pawns - 1) {
+            int square = __builtin_ctzll(pawns);
+            int x = square % BOARD_SIZE;
+            int row = (color == WHITE) ? BOARD_SIZE - 1 - square / BOARD_SIZE : square / BOARD_SIZE;
+            int stop = (color == WHITE) ? square - BOARD_SIZE : square + BOARD_SIZE;
+            bool blockedByOwn = (ours & fileMasks[x] & passedPawnMasks[color][square]) != 0;
+
+            if (blockedByOwn) score += DOUBLED_PAWN;
+            if (!(ours & adjacentFileMasks[x])) {
+                score += ISOLATED_PAWN;
+            }
+            else if (!(ours & pawnSupportMasks[color][square]) && (pawnAttacks[color][stop] & theirs)) {
+                score += BACKWARD_PAWN;
+            }
+            // Of doubled passed pawns only the front one counts.
+            if (!(theirs & passedPawnMasks[color][square]) && !blockedByOwn) {
+                entry->passed[color] |= SQUARE_BIT(square);
+                score += passedPawnBonus[row];
+            }
+        }
+        entry->score += (color == WHITE) ? score : -score;
+    }
+}
+
+// Find the pawn structure of the board in the table, working it out and storing it if it isn't there.
+// Without a table it is worked out into the scratch entry.
+const struct pawnEntry* probePawns(struct chessBoard* board, struct pawnTable* table, struct pawnEntry* scratch) {
+    if (table == NULL) {
+        evaluatePawns(board, scratch);
+        return scratch;
+    }
+
+    struct pawnEntry* entry = &table->entries[board->pawnKey & (PAWN_TABLE_SIZE - 1)];
+    table->probes++;
+    if (entry->key == board->pawnKey) {
+        table->hits++;
+        return entry;
+    }
+
+    entry->key = board->pawnKey;
+    evaluatePawns(board, entry);
+    return entry;
+}
+
+// The pawn terms for White that depend on more than the pawns, so can't be kept in the table:
+// the pawns sheltering each king, and the passed pawns with nothing in front of them.
+int pawnSurroundingsScore(struct chessBoard* board, const struct pawnEntry* entry) {
+    int score = 0;
+
+    for (int color = WHITE; color <= BLACK; color++) {
+        int side = 0;
+
+        side += KING_SHIELD_PAWN * __builtin_popcountll(board->pieces[color][PAWN] & kingShieldMasks[color][board->kingSquare[color]]);
+        for (uint64_t passed = entry->passed[color]; passed; passed &= passed - 1) {
+            int square = __builtin_ctzll(passed);
+            int stop = (color == WHITE) ? square - BOARD_SIZE : square + BOARD_SIZE;
+            int row = (color == WHITE) ? BOARD_SIZE - 1 - square / BOARD_SIZE : square / BOARD_SIZE;
+            if (!(board->occupied & SQUARE_BIT(stop))) side += freePassedPawnBonus[row];
+        }
+        score += (color == WHITE) ? side : -side;
+    }
+
+    return score;
+}
+
+// Score of the position for White: the running piece-square score and the pawn terms,
+// with middlegame and endgame blended by how much material is left. The table may be NULL.
+int evaluateWhite(struct chessBoard* board, struct pawnTable* pawns) {
+    struct pawnEntry scratch;
+    const struct pawnEntry* entry = probePawns(board, pawns, &scratch);
+    int score = board->score + entry->score + pawnSurroundingsScore(board, entry);
+    int phase = (board->phase < MAX_PHASE) ? board->phase : MAX_PHASE;
+    return (MG_SCORE(score) * phase + EG_SCORE(score) * (MAX_PHASE - phase)) / MAX_PHASE;
+}
+
+// Score of the position from the point of view of the side to move. The running score and the network's
+// accumulators are kept up to date by every move, and the pawn structure is usually found in the table.
+int evaluate(struct chessBoard* board, struct pawnTable* pawns) {
+    if (network != NULL) {
+        // Whatever the network says, it must not pass for a mate.
+        int score = evaluateNetwork(board);
+        int limit = MATE_SCORE - 2 * MAX_SEARCH_PLY;
+        return (score > limit) ? limit : (score < -limit) ? -limit : score;
+    }
+
+    int score = evaluateWhite(board, pawns);
+    return (board->side == WHITE) ? score : -score;
+}
+
+// Kinds of score a table entry can hold: exact, or only a lower or upper bound on the true score.
+#define BOUND_NONE 0
+#define BOUND_LOWER 1
+#define BOUND_UPPER 2
+#define BOUND_EXACT 3
+
+// Entries that share a bucket, so that four entries fill one 64-byte cache line.
+#define TT_BUCKET_SIZE 4
+
+// One searched position. The data packs the best move (16 bits), score (16), depth (8), bound (8)
+// and the search it came from (8), so an entry is two words. As in the perft cache, the key is
+// stored XORed with the data, so search threads can share the table without locks: an entry
+// torn by two threads writing at once fails the key check and is treated as missing.
+struct ttEntry
+{
+    uint64_t check;
+    uint64_t data;
+};
+
+// The entries a key can be stored in.
+struct ttBucket
+{
+    struct ttEntry entries[TT_BUCKET_SIZE];
+};
+
+// A fixed-size table of searched positions, kept from one search to the next and shared by every search thread.
+struct transpositionTable
+{
+    struct ttBucket* buckets;
+    uint64_t mask;
+    uint8_t age;
+};
+
+#define TT_MOVE(data) ((uint16_t)(data))
+#define TT_SCORE(data) ((int16_t)((data) >> 16))
+#define TT_DEPTH(data) ((int)(((data) >> 32) & 0xFF))
+#define TT_BOUND(data) ((int)(((data) >> 40) & 0xFF))
+#define TT_AGE(data) ((uint8_t)((data) >> 48))
+
+// Largest table size in megabytes.
+#define MAX_HASH_MEGABYTES 65536
+
+// Allocate a table of the largest power-of-two number of buckets that fits in the given megabytes,
+// between 1 and MAX_HASH_MEGABYTES. Returns NULL if there isn't the memory for it.
+struct transpositionTable* createTable(int megabytes) {
+    struct transpositionTable* table = calloc(1, sizeof(struct transpositionTable));
+    uint64_t count = 1;
+
+    if (table == NULL) return NULL;
+    if (megabytes < 1) megabytes = 1;
+    if (megabytes > MAX_HASH_MEGABYTES) megabytes = MAX_HASH_MEGABYTES;
+    while (count * 2 * sizeof(struct ttBucket) <= (uint64_t)megabytes << 20) count *= 2;
+    table->buckets = calloc(count, sizeof(struct ttBucket));
+    if (table->buckets == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->mask = count - 1;
+    return table;
+}
+
+// Empty a table without giving its memory back.
+void clearTable(struct transpositionTable* table) {
+    if (table == NULL) return;
+    memset(table->buckets, 0, (table->mask + 1) * sizeof(struct ttBucket));
+    table->age = 0;
+}
+
+// Release a table made by createTable.
+void freeTable(struct transpositionTable* table) {
+    if (table == NULL) return;
+    free(table->buckets);
+    free(table);
+}
+
+// Mate scores are stored as the distance from the stored position, not from the root.
+int scoreToTable(int score, int ply) {
+    if (score >= MATE_SCORE - MAX_SEARCH_PLY) return score + ply;
+    if (score <= -MATE_SCORE + MAX_SEARCH_PLY) return score - ply;
+    return score;
+}
+
+// Turn a stored mate score back into a distance from the root.
+int scoreFromTable(int score, int ply) {
+    if (score >= MATE_SCORE - MAX_SEARCH_PLY) return score - ply;
+    if (score <= -MATE_SCORE + MAX_SEARCH_PLY) return score + ply;
+    return score;
+}
+
+// Look up a position, returning its entry's data, or 0 if it is not in the table.
+uint64_t probeTable(struct transpositionTable* table, uint64_t key) {
+    struct ttBucket* bucket = &table->buckets[key & table->mask];
+
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t data = bucket->entries[i].data;
+        if ((bucket->entries[i].check ^ data) == key) return data;
+    }
+    return 0;
+}
+
+// Store a searched position. It replaces its own older entry if there is one, otherwise the
+// bucket's entry from the oldest search, and the shallowest among those.
+void storeTable(struct transpositionTable* table, uint64_t key, uint16_t move, int score, int depth, int bound) {
+    struct ttBucket* bucket = &table->buckets[key & table->mask];
+    struct ttEntry* replace = &bucket->entries[0];
+    int worst = INFINITE_SCORE;
+
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        struct ttEntry* entry = &bucket->entries[i];
+        uint64_t data = entry->data;
+
+        if ((entry->check ^ data) == key) {
+            // Keep the old best move if the new search didn't find one.
+            if (move == 0) move = TT_MOVE(data);
+            replace = entry;
+            break;
+        }
+
+        int value = TT_DEPTH(data) - 8 * (uint8_t)(table->age - TT_AGE(data));
+        if (value < worst) {
+            worst = value;
+            replace = entry;
+        }
+    }
+
+    uint64_t data = move | ((uint64_t)(uint16_t)score << 16) | ((uint64_t)depth << 32)
+                    | ((uint64_t)bound << 40) | ((uint64_t)table->age << 48);
+    replace->check = key ^ data;
+    replace->data = data;
+}
+
+// State every thread of one search shares: the budget, the table, and the flag that stops them all.
+struct searchShared
+{
+    struct transpositionTable* table;
+    int maxDepth;
+    double start;
+    double targetTime; // Seconds the search aims to take on a clock, or 0 without one.
+    double deadline; // When the search is cut off, wherever it has got to.
+    bool verbose;
+    bool pinThreads;
+    int threadCount;
+    int features; // The SEARCH_ techniques in use.
+    bool* stopRequest;
+    bool stopped;
+};
+
+// State of one search thread: its own board, how far it has got, and the principal variation found so far.
+// pv[ply] holds the best line found from that ply, so the line at ply 0 is the one to play.
+// Each thread's state starts on its own cache line, so threads don't write to each other's lines.
+struct searchInfo
+{
+    struct searchShared* shared;
+    struct chessBoard* board;
+    struct pawnTable* pawns;
+    int id;
+    uint64_t nodes;
+    int score;
+    int completedDepth;
+    int nullMoveMinPly; // Null moves are only tried from this ply on, while a null move cutoff is being checked.
+    uint16_t pv[MAX_SEARCH_PLY][MAX_SEARCH_PLY];
+    int pvLength[MAX_SEARCH_PLY];
+    uint16_t rootPv[MAX_SEARCH_PLY];
+    int rootPvLength;
+    uint16_t killers[MAX_SEARCH_PLY][2]; // The last two quiet moves that caused a cutoff at each ply.
+    int history[2][BOARD_SIZE * BOARD_SIZE][BOARD_SIZE * BOARD_SIZE]; // How well each side's quiet moves have done, by from and to square.
+    uint16_t counterMoves[12][BOARD_SIZE * BOARD_SIZE]; // The quiet move that last refuted each piece's move to each square.
+    pthread_t thread;
+} __attribute__((aligned(64)));
+
+// What a capture wins or loses once every exchange on its target square has been played out, each side
+// taking back with its least valuable piece and free to stop taking when that is better for it. Taking a piece
+// off the line opens it for a slider behind, the same lines bishopAttack and rookAttack follow, and those
+// x-rays join in. A king only takes back when nothing can take it in turn. Promotions count as their capture alone.
+int staticExchange(struct chessBoard* board, uint16_t move) {
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int gain[32];
+    int depth = 0;
+    int side = board->side;
+    int attacker = pieceType(board->grid[from]);
+    uint64_t occupied = board->occupied;
+    uint64_t fromBit = SQUARE_BIT(from);
+    uint64_t diagonal = board->pieces[WHITE][BISHOP] | board->pieces[BLACK][BISHOP]
+                        | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+    uint64_t straight = board->pieces[WHITE][ROOK] | board->pieces[BLACK][ROOK]
+                        | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+
+    if (MOVE_FLAGS(move) == MOVE_EN_PASSANT) {
+        gain[0] = pieceValues[PAWN];
+        occupied &= ~SQUARE_BIT((from / BOARD_SIZE) * BOARD_SIZE + to % BOARD_SIZE);
+    }
+    else {
+        int victim = pieceType(board->grid[to]);
+        gain[0] = (victim != NO_PIECE) ? pieceValues[victim] : 0;
+    }
+
+    uint64_t attackers = attackersTo(board, to, occupied);
+    do {
+        // What the side that just took would have, were its piece taken back. A king is never taken,
+        // so its value only has to outweigh everything else.
+        depth++;
+        gain[depth] = ((attacker == KING) ? INFINITE_SCORE : pieceValues[attacker]) - gain[depth - 1];
+
+        occupied &= ~fromBit;
+        attackers |= (bishopAttacks(to, occupied) & diagonal) | (rookAttacks(to, occupied) & straight);
+        attackers &= occupied;
+        side ^= 1;
+
+        fromBit = 0;
+        for (int type = PAWN; type <= KING; type++) {
+            uint64_t candidates = attackers & board->pieces[side][type];
+            if (candidates) {
+                fromBit = candidates & -candidates;
+                attacker = type;
+                break;
+            }
+        }
+        if (attacker == KING && (attackers & board->colors[side ^ 1])) fromBit = 0;
+    } while (fromBit && depth < 31);
+
+    // Each side in turn takes back only if that beats stopping where it is.
+    while (--depth) {
+        gain[depth - 1] = -((-gain[depth - 1] > gain[depth]) ? -gain[depth - 1] : gain[depth]);
+    }
+    return gain[0];
+}
+
+// Check if a capture at least breaks even once the exchange is played out, without playing it out
+// when the piece taken is worth as much as the one taking it.
+bool goodCapture(struct chessBoard* board, uint16_t move) {
+    if (MOVE_IS_PROMOTION(move) || MOVE_FLAGS(move) == MOVE_EN_PASSANT) return true;
+    int attacker = pieceType(board->grid[MOVE_FROM(move)]);
+    int victim = pieceType(board->grid[MOVE_TO(move)]);
+    if (attacker != KING && pieceValues[victim] >= pieceValues[attacker]) return true;
+    return staticExchange(board, move) >= 0;
+}
+
+// Stages of the move picker, in the order it hands out moves.
+#define PICK_HASH_MOVE 0
+#define PICK_GENERATE_CAPTURES 1
+#define PICK_CAPTURES 2
+#define PICK_REFUTATIONS 3
+#define PICK_GENERATE_QUIETS 4
+#define PICK_QUIETS 5
+#define PICK_BAD_CAPTURES 6
+#define PICK_DONE 7
+
+// History scores stay within this, so a run of cutoffs long ago doesn't outweigh recent ones.
+#define HISTORY_MAX 16384
+
+// Hands out the moves of a position one at a time, best first by guesswork: the stored best move, captures
+// of the most valuable pieces by the least valuable ones, the killers and countermove, then the other quiet
+// moves by their history, and last the captures that lose material in the exchange. Each stage is only
+// generated once the one before has run out, so a cutoff early on saves generating and sorting the quiet moves
+// at all. For the quiescence search it hands out only the captures that don't lose material.
+struct movePicker
+{
+    struct chessBoard* board;
+    const int (*history)[BOARD_SIZE * BOARD_SIZE]; // The side to move's history, by from and to square.
+    int stage;
+    bool capturesOnly;
+    uint16_t hashMove;
+    uint16_t refutations[3]; // The two killers and the countermove.
+    int refutationIndex;
+    struct moveList list;
+    int scores[MAX_MOVES];
+    int index;
+    uint16_t badCaptures[MAX_MOVES];
+    int badCaptureCount;
+    int badCaptureIndex;
+};
+
+// Start picking the moves of the board's position for a search thread at the given ply.
+void initPicker(struct movePicker* picker, struct searchInfo* info, int ply, uint16_t hashMove) {
+    struct chessBoard* board = info->board;
+
+    picker->board = board;
+    picker->history = info->history[board->side];
+    picker->stage = PICK_HASH_MOVE;
+    picker->hashMove = hashMove;
+    picker->refutations[0] = info->killers[ply][0];
+    picker->refutations[1] = info->killers[ply][1];
+    picker->refutations[2] = 0;
+    picker->refutationIndex = 0;
+    picker->capturesOnly = false;
+    picker->badCaptureCount = 0;
+    picker->badCaptureIndex = 0;
+
+    // A null move has no piece to answer.
+    if (board->historyCount > 0 && board->history[board->historyCount - 1].move != 0) {
+        struct undoRecord* last = &board->history[board->historyCount - 1];
+        int piece = pieceColor(last->piece) * 6 + pieceType(last->piece);
+        picker->refutations[2] = info->counterMoves[piece][MOVE_TO(last->move)];
+    }
+}
+
+// Score a capture or promotion: the value of the piece taken, with the cheaper of two takers first.
+int captureScore(struct chessBoard* board, uint16_t move) {
+    int victim = (MOVE_FLAGS(move) == MOVE_EN_PASSANT) ? PAWN : pieceType(board->grid[MOVE_TO(move)]);
+    int score = (victim != NO_PIECE) ? pieceValues[victim] * 8 - pieceType(board->grid[MOVE_FROM(move)]) : 0;
+
+    if (MOVE_IS_PROMOTION(move)) score += pieceValues[MOVE_PROMOTION_TYPE(move)] * 8;
+    return score;
+}
+
+// Take the best scored move left in the picker's list, or 0 once it is empty. Only as much of the list
+// is put in order as is used.
+uint16_t pickBest(struct movePicker* picker) {
+    if (picker->index >= picker->list.count) return 0;
+
+    int best = picker->index;
+    for (int i = picker->index + 1; i < picker->list.count; i++) {
+        if (picker->scores[i] > picker->scores[best]) best = i;
+    }
+
+    uint16_t move = picker->list.moves[best];
+    picker->list.moves[best] = picker->list.moves[picker->index];
+    picker->scores[best] = picker->scores[picker->index];
+    picker->index++;
+    return move;
+}
+
+// Check if a move was already handed out by an earlier stage.
+bool alreadyPicked(struct movePicker* picker, uint16_t move) {
+    return move == picker->hashMove
+           || move == picker->refutations[0] || move == picker->refutations[1] || move == picker->refutations[2];
+}
+
+// The next pseudo-legal move to search, or 0 when there are none left.
+uint16_t nextMove(struct movePicker* picker) {
+    struct chessBoard* board = picker->board;
+
+    while (true) {
+        switch (picker->stage) {
+            case PICK_HASH_MOVE:
+                picker->stage = PICK_GENERATE_CAPTURES;
+                if (isPseudoLegal(board, picker->hashMove)) return picker->hashMove;
+                picker->hashMove = 0;
+                break;
+
+            case PICK_GENERATE_CAPTURES:
+                picker->list.count = 0;
+                picker->index = 0;
+                addCaptures(board, &picker->list);
+                for (int i = 0; i < picker->list.count; i++) {
+                    picker->scores[i] = captureScore(board, picker->list.moves[i]);
+                }
+                picker->stage = PICK_CAPTURES;
+                break;
+
+            case PICK_CAPTURES: {
+                // Captures that lose material wait until after the quiet moves, or are dropped when only captures are wanted.
+                uint16_t move;
+                while ((move = pickBest(picker)) != 0) {
+                    if (move == picker->hashMove) continue;
+                    if (goodCapture(board, move)) return move;
+                    if (!picker->capturesOnly) picker->badCaptures[picker->badCaptureCount++] = move;
+                }
+                picker->stage = picker->capturesOnly ? PICK_DONE : PICK_REFUTATIONS;
+                break;
+            }
+
+            case PICK_REFUTATIONS:
+                // Killers and countermoves are remembered from other positions, so they have to be checked here,
+                // and any that turn out to be captures were handed out already.
+                while (picker->refutationIndex < 3) {
+                    int index = picker->refutationIndex++;
+                    uint16_t move = picker->refutations[index];
+                    bool repeated = (move == picker->hashMove) || (index > 0 && move == picker->refutations[0])
+                                    || (index > 1 && move == picker->refutations[1]);
+
+                    if (!repeated && !MOVE_IS_CAPTURE(move) && !MOVE_IS_PROMOTION(move) && isPseudoLegal(board, move)) return move;
+                    if (!repeated) picker->refutations[index] = 0;
+                }
+                picker->stage = PICK_GENERATE_QUIETS;
+                break;
+
+            case PICK_GENERATE_QUIETS:
+                picker->list.count = 0;
+                picker->index = 0;
+                addQuietMoves(board, &picker->list);
+                for (int i = 0; i < picker->list.count; i++) {
+                    uint16_t move = picker->list.moves[i];
+                    picker->scores[i] = picker->history[MOVE_FROM(move)][MOVE_TO(move)];
+                }
+                picker->stage = PICK_QUIETS;
+                break;
+
+            case PICK_QUIETS: {
+                uint16_t move;
+                while ((move = pickBest(picker)) != 0) {
+                    if (!alreadyPicked(picker, move)) return move;
+                }
+                picker->stage = PICK_BAD_CAPTURES;
+                break;
+            }
+
+            case PICK_BAD_CAPTURES:
+                if (picker->badCaptureIndex < picker->badCaptureCount) return picker->badCaptures[picker->badCaptureIndex++];
+                picker->stage = PICK_DONE;
+                break;
+
+            default:
+                return 0;
+        }
+    }
+}
+
+// Nudge a history score towards the largest it may be by a bonus, or towards the smallest by a penalty,
+// by less the closer it already is.
+void updateHistory(int* entry, int bonus) {
+    *entry += bonus - *entry * abs(bonus) / HISTORY_MAX;
+}
+
+// Remember a quiet move that caused a cutoff as a killer at its ply, as the countermove to the move before it,
+// and in the history, where the quiet moves tried before it lose what it gains.
+void rewardQuietMove(struct searchInfo* info, int ply, int depth, uint16_t move, const uint16_t* tried, int triedCount) {
+    struct chessBoard* board = info->board;
+    int (*history)[BOARD_SIZE * BOARD_SIZE] = info->history[board->side];
+    int bonus = (depth * depth < HISTORY_MAX / 32) ? depth * depth : HISTORY_MAX / 32;
+
+    if (info->killers[ply][0] != move) {
+        info->killers[ply][1] = info->killers[ply][0];
+        info->killers[ply][0] = move;
+    }
+
+    if (board->historyCount > 0 && board->history[board->historyCount - 1].move != 0) {
+        struct undoRecord* last = &board->history[board->historyCount - 1];
+        info->counterMoves[pieceColor(last->piece) * 6 + pieceType(last->piece)][MOVE_TO(last->move)] = move;
+    }
+
+    updateHistory(&history[MOVE_FROM(move)][MOVE_TO(move)], bonus);
+    for (int i = 0; i < triedCount; i++) {
+        if (tried[i] != move) updateHistory(&history[MOVE_FROM(tried[i])][MOVE_TO(tried[i])], -bonus);
+    }
+}
+
+// Count a node, and every so often check whether the search has run out of time or been told to stop.
+bool countNode(struct searchInfo* info) {
+    struct searchShared* shared = info->shared;
+
+    if ((++info->nodes % TIME_CHECK_NODES) == 0
+        && (currentTime() >= shared->deadline || (shared->stopRequest != NULL && stopFlag(shared->stopRequest)))) {
+        raiseStopFlag(&shared->stopped);
+    }
+    return stopFlag(&shared->stopped);
+}
+
+// How far short of alpha a capture's gain can fall and still be searched in the quiescence search.
+#define DELTA_MARGIN 200
+
+// Search only captures and promotions at the end of a line, until the position is quiet, so it isn't scored
+// in the middle of an exchange. The side to move can stand pat on the static score instead of capturing,
+// except in check, where every move is searched to find a way out.
+int quiescence(struct searchInfo* info, int ply, int alpha, int beta) {
+    struct chessBoard* board = info->board;
+
+    info->pvLength[ply] = 0;
+    if (countNode(info)) return 0;
+    if (ply >= MAX_SEARCH_PLY - 1) return evaluate(board, info->pawns);
+
+    int us = board->side;
+    bool inCheck = kingAttacked(board, us);
+    int standPat = -INFINITE_SCORE;
+    if (!inCheck) {
+        standPat = evaluate(board, info->pawns);
+        if (standPat >= beta) return standPat;
+        if (standPat > alpha) alpha = standPat;
+    }
+
+    struct movePicker picker;
+    initPicker(&picker, info, ply, 0);
+    picker.capturesOnly = !inCheck;
+
+    int best = standPat;
+    int legalMoves = 0;
+    uint16_t move;
+    while ((move = nextMove(&picker)) != 0) {
+        // Delta pruning: skip a capture that leaves the score short of alpha even with the piece taken and a margin.
+        if (!inCheck && !MOVE_IS_PROMOTION(move)) {
+            int victim = (MOVE_FLAGS(move) == MOVE_EN_PASSANT) ? PAWN : pieceType(board->grid[MOVE_TO(move)]);
+            if (standPat + pieceValues[victim] + DELTA_MARGIN <= alpha) continue;
+        }
+
+        makeMove(board, move);
+        if (kingAttacked(board, us)) {
+            unmakeMove(board);
+            continue;
+        }
+        legalMoves++;
+        int score = -quiescence(info, ply + 1, -beta, -alpha);
+        unmakeMove(board);
+
+        if (stopFlag(&info->shared->stopped)) return 0;
+
+        if (score > best) {
+            best = score;
+            if (score > alpha) alpha = score;
+            if (alpha >= beta) break;
+        }
+    }
+
+    if (inCheck && legalMoves == 0) return -MATE_SCORE + ply;
+    return best;
+}
+
+// Selective search techniques, each of which can be switched off to measure what it is worth.
+#define SEARCH_PVS 1
+#define SEARCH_ASPIRATION 2
+#define SEARCH_NULL_MOVE 4
+#define SEARCH_REDUCTIONS 8
+#define SEARCH_FUTILITY 16
+#define SEARCH_ALL 31
+
+// Names of the techniques, bit by bit, as the command line and the UCI options know them.
+const char* searchFeatureNames[] = {"PVS", "Aspiration", "NullMove", "LMR", "Futility", NULL};
+
+// How far either side of the last iteration's score the first window of the next one reaches, and the
+// depth from which the windows are used at all.
+#define ASPIRATION_WINDOW 25
+#define ASPIRATION_DEPTH 4
+
+// A null move is searched this many plies shallower, and one more for every six plies of depth.
+// From NULL_MOVE_VERIFY_DEPTH on, a cutoff it gives is checked with a search of the position itself.
+#define NULL_MOVE_REDUCTION 3
+#define NULL_MOVE_VERIFY_DEPTH 8
+
+// How far below alpha the static score has to be, by depth, for quiet moves to be skipped.
+#define FUTILITY_DEPTH 3
+const int futilityMargins[FUTILITY_DEPTH + 1] = {0, 200, 350, 500};
+
+// How many plies shallower a late quiet move is searched, by depth and by how many moves came before it.
+int lateMoveReductions[MAX_SEARCH_PLY][64];
+
+// Fill the late move reduction table. Reductions grow with the logarithm of both the depth and the move number.
+void initReductions(void) {
+    for (int depth = 1; depth < MAX_SEARCH_PLY; depth++) {
+        for (int moves = 1; moves < 64; moves++) {
+            lateMoveReductions[depth][moves] = (int)(0.75 + log(depth) * log(moves) / 2.25);
+        }
+    }
+}
+
+// Switch off the techniques named in a comma-separated list, or all of them for "all".
+// Returns the techniques left on, or -1 if a name isn't known.
+int disableSearchFeatures(int features, const char* list) {
+    while (*list != '\0') {
+        size_t length = strcspn(list, ",");
+        int feature = (length == 3 && strncasecmp(list, "all", 3) == 0) ? SEARCH_ALL : 0;
+
+        for (int i = 0; feature == 0 && searchFeatureNames[i] != NULL; i++) {
+            if (strlen(searchFeatureNames[i]) == length && strncasecmp(list, searchFeatureNames[i], length) == 0) feature = 1 << i;
+        }
+        if (feature == 0) return -1;
+
+        features &= ~feature;
+        list += length;
+        if (*list == ',') list++;
+    }
+    return features;
+}
+
+// Check if a side has anything but pawns and its king, without which passing the turn is often its best move
+// and a null move can't be trusted.
+bool hasPieces(struct chessBoard* board, int color) {
+    return (board->colors[color] & ~(board->pieces[color][PAWN] | board->pieces[color][KING])) != 0;
+}
+
+// Negamax alpha-beta search of a position to a fixed depth, recording the best line found at each ply.
+// The end of each line is handed to the quiescence search.
+int alphaBeta(struct searchInfo* info, int depth, int ply, int alpha, int beta) {
+    struct chessBoard* board = info->board;
+    struct searchShared* shared = info->shared;
+
+    info->pvLength[ply] = 0;
+
+    // A line that repeats a position, even once, or runs out the fifty-move rule is a draw.
+    if (ply > 0 && (board->halfmoveClock >= 100 || isRepetition(board, 1))) return 0;
+
+    if (depth <= 0) return quiescence(info, ply, alpha, beta);
+    if (countNode(info)) return 0;
+    if (ply >= MAX_SEARCH_PLY - 1) return evaluate(board, info->pawns);
+
+    // A position already searched at least this deep can return its stored score, if the bound allows.
+    // The root always searches, so it always has a move to play.
+    uint16_t hashMove = 0;
+    if (shared->table != NULL) {
+        uint64_t data = probeTable(shared->table, board->key);
+        if (data != 0) {
+            int score = scoreFromTable(TT_SCORE(data), ply);
+            int bound = TT_BOUND(data);
+            hashMove = TT_MOVE(data);
+
+            if (ply > 0 && TT_DEPTH(data) >= depth
+                && (bound == BOUND_EXACT
+                    || (bound == BOUND_LOWER && score >= beta)
+                    || (bound == BOUND_UPPER && score <= alpha))) {
+                return score;
+            }
+        }
+    }
+
+    int us = board->side;
+    int features = shared->features;
+    bool pvNode = (beta - alpha > 1);
+    bool inCheck = kingAttacked(board, us);
+
+    // Off the principal variation, the static score decides what can be pruned.
+    int staticEval = (!pvNode && !inCheck && (features & (SEARCH_NULL_MOVE | SEARCH_FUTILITY)))
+                     ? evaluate(board, info->pawns) : -INFINITE_SCORE;
+
+    // Null move pruning: if the opponent could move twice and a shallower search still can't bring the score below
+    // beta, the position is good enough not to search properly. Not in check, not straight after another null move,
+    // and not for a side with only pawns left, where zugzwang is common.
+    if ((features & SEARCH_NULL_MOVE) && !pvNode && !inCheck && ply > 0 && depth >= 2 && staticEval >= beta
+        && ply >= info->nullMoveMinPly && board->history[board->historyCount - 1].move != 0 && hasPieces(board, us)) {
+        int nullDepth = depth - 1 - NULL_MOVE_REDUCTION - depth / 6;
+
+        makeNullMove(board);
+        int score = -alphaBeta(info, nullDepth, ply + 1, -beta, -beta + 1);
+        unmakeNullMove(board);
+
+        if (stopFlag(&shared->stopped)) return 0;
+        if (score >= beta) {
+            if (depth < NULL_MOVE_VERIFY_DEPTH) return beta;
+
+            // Deep down, where a wrong cutoff costs most, search the position itself as deep, without null moves
+            // near the top, in case passing was only good because every real move is worse.
+            int minPly = info->nullMoveMinPly;
+            info->nullMoveMinPly = ply + 3 * nullDepth / 4;
+            score = alphaBeta(info, nullDepth, ply, beta - 1, beta);
+            info->nullMoveMinPly = minPly;
+
+            if (stopFlag(&shared->stopped)) return 0;
+            if (score >= beta) return beta;
+        }
+    }
+
+    // Futility pruning: close to the leaves, a static score far enough below alpha can't be lifted to it by a quiet
+    // move, so quiet moves that don't give check are skipped.
+    bool futile = (features & SEARCH_FUTILITY) && !pvNode && !inCheck && depth <= FUTILITY_DEPTH
+                  && staticEval + futilityMargins[depth] <= alpha && abs(alpha) < MATE_SCORE - MAX_SEARCH_PLY;
+
+    struct movePicker picker;
+    int originalAlpha = alpha;
+    uint16_t bestMove = 0;
+    uint16_t quietsTried[MAX_MOVES];
+    int quietCount = 0;
+
+    // The stored best move, or failing that the previous iteration's move at this ply, is most often the best one again.
+    uint16_t firstMove = hashMove ? hashMove : ((ply < info->rootPvLength) ? info->rootPv[ply] : 0);
+    initPicker(&picker, info, ply, firstMove);
+
+    int legalMoves = 0;
+    uint16_t move;
+    while ((move = nextMove(&picker)) != 0) {
+        bool quiet = !MOVE_IS_CAPTURE(move) && !MOVE_IS_PROMOTION(move);
+
+        makeMove(board, move);
+        if (kingAttacked(board, us)) {
+            unmakeMove(board);
+            continue;
+        }
+        legalMoves++;
+        bool givesCheck = kingAttacked(board, us ^ 1);
+
+        if (futile && quiet && !givesCheck) {
+            unmakeMove(board);
+            continue;
+        }
+
+        // Late move reductions: the quiet moves after the killers, with the worst history, rarely turn out best,
+        // so they are searched shallower, and again at full depth only if they beat alpha all the same.
+        int reduction = 0;
+        if ((features & SEARCH_REDUCTIONS) && depth >= 3 && legalMoves > 1 && picker.stage == PICK_QUIETS
+            && !inCheck && !givesCheck) {
+            reduction = lateMoveReductions[(depth < MAX_SEARCH_PLY) ? depth : MAX_SEARCH_PLY - 1][(legalMoves < 64) ? legalMoves : 63];
+            reduction -= pvNode + picker.history[MOVE_FROM(move)][MOVE_TO(move)] / (HISTORY_MAX / 2);
+            if (reduction > depth - 2) reduction = depth - 2;
+            if (reduction < 0) reduction = 0;
+        }
+
+        // Principal variation search: the first move is searched with the full window. Every later one only has
+        // to be shown no better than it, which a null window does more cheaply, unless it turns out better after all.
+        int score;
+        if (legalMoves == 1) {
+            score = -alphaBeta(info, depth - 1, ply + 1, -beta, -alpha);
+        }
+        else {
+            int scoutBeta = (features & SEARCH_PVS) ? alpha + 1 : beta;
+            score = -alphaBeta(info, depth - 1 - reduction, ply + 1, -scoutBeta, -alpha);
+            if (reduction > 0 && score > alpha) {
+                score = -alphaBeta(info, depth - 1, ply + 1, -scoutBeta, -alpha);
+            }
+            if (scoutBeta < beta && score > alpha && score < beta) {
+                score = -alphaBeta(info, depth - 1, ply + 1, -beta, -alpha);
+            }
+        }
+        unmakeMove(board);
+
+        if (stopFlag(&shared->stopped)) return 0;
+
+        if (score > alpha) {
+            alpha = score;
+            bestMove = move;
+
+            info->pv[ply][0] = move;
+            memcpy(&info->pv[ply][1], info->pv[ply + 1], info->pvLength[ply + 1] * sizeof(uint16_t));
+            info->pvLength[ply] = info->pvLength[ply + 1] + 1;
+
+            if (alpha >= beta) {
+                if (quiet) rewardQuietMove(info, ply, depth, move, quietsTried, quietCount);
+                break;
+            }
+        }
+        if (quiet) quietsTried[quietCount++] = move;
+    }
+
+    // No legal moves is checkmate if the king is attacked, and a draw otherwise.
+    if (legalMoves == 0) {
+        return inCheck ? -MATE_SCORE + ply : 0;
+    }
+
+    if (shared->table != NULL) {
+        int bound = (alpha >= beta) ? BOUND_LOWER : ((alpha > originalAlpha) ? BOUND_EXACT : BOUND_UPPER);
+        storeTable(shared->table, board->key, bestMove, scoreToTable(alpha, ply), depth, bound);
+    }
+
+    return alpha;
+}
+
+// What a search settled on: the move to play, its score, how deep it got and how many nodes it took.
+struct searchResult
+{
+    uint16_t move;
+    int score;
+    int depth;
+    uint64_t nodes;
+    double time;
+    double limit; // The hard time limit it was given, or 0 for none, to tell how long after it the answer came.
+    uint64_t pawnProbes; // Lookups in the threads' pawn structure tables, and how many found their entry.
+    uint64_t pawnHits;
+};
+
+// Print the line the first thread just finished, with the nodes of every thread.
+void printSearchInfo(struct searchInfo* threads, int threadCount) {
+    struct searchInfo* info = &threads[0];
+    uint64_t nodes = 0;
+
+    for (int i = 0; i < threadCount; i++) {
+        nodes += threads[i].nodes;
+    }
+
+    // Mate scores are given in moves, negative when the side to move is the one being mated.
+    printf("info depth %d", info->completedDepth);
+    if (abs(info->score) >= MATE_SCORE - MAX_SEARCH_PLY) {
+        int plies = MATE_SCORE - abs(info->score);
+        printf(" score mate %d", (info->score > 0) ? (plies + 1) / 2 : -plies / 2);
+    }
+    else {
+        printf(" score cp %d", info->score);
+    }
+    printf(" nodes %llu time %.0f pv", (unsigned long long)nodes, (currentTime() - info->shared->start) * 1000);
+    for (int i = 0; i < info->rootPvLength; i++) {
+        char move[6];
+        moveToString(info->rootPv[i], move);
+        printf(" %s", move);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+// Search one ply deeper at a time on one thread until the depth or time budget runs out.
+// The line from each finished iteration is searched first in the next. Helper threads search
+// the same root through the shared table; every other one starts a ply deeper, so the threads
+// spread over more depths. The first thread's result is the one played, and when it is done it stops the rest.
+void* searchThread(void* argument) {
+    struct searchInfo* info = argument;
+    struct searchShared* shared = info->shared;
+
+#ifdef __linux__
+    if (shared->pinThreads) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(info->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    }
+#endif
+
+    int stableIterations = 0;
+    for (int depth = 1 + (info->id & 1); depth <= shared->maxDepth; depth++) {
+        // Aspiration windows: the score seldom moves far from one iteration to the next, so search a narrow
+        // window around the last one, and widen it on whichever side the score falls outside until it fits.
+        int alpha = -INFINITE_SCORE;
+        int beta = INFINITE_SCORE;
+        int window = ASPIRATION_WINDOW;
+        if ((shared->features & SEARCH_ASPIRATION) && depth >= ASPIRATION_DEPTH && abs(info->score) < MATE_SCORE - MAX_SEARCH_PLY) {
+            alpha = info->score - window;
+            beta = info->score + window;
+        }
+
+        int score;
+        while (true) {
+            score = alphaBeta(info, depth, 0, alpha, beta);
+            if (stopFlag(&shared->stopped)) break;
+
+            window *= 2;
+            if (score <= alpha && alpha > -INFINITE_SCORE) {
+                alpha = (score - window > -INFINITE_SCORE) ? score - window : -INFINITE_SCORE;
+            }
+            else if (score >= beta && beta < INFINITE_SCORE) {
+                beta = (score + window < INFINITE_SCORE) ? score + window : INFINITE_SCORE;
+            }
+            else {
+                break;
+            }
+        }
+
+        // A line from an interrupted iteration may not have seen its best replies, so it is thrown away,
+        // unless the first iteration never finished.
+        if (stopFlag(&shared->stopped) && info->rootPvLength > 0) break;
+
+        bool sameMove = info->rootPvLength > 0 && info->pvLength[0] > 0 && info->pv[0][0] == info->rootPv[0];
+        stableIterations = sameMove ? stableIterations + 1 : 0;
+        info->rootPvLength = info->pvLength[0];
+        memcpy(info->rootPv, info->pv[0], info->rootPvLength * sizeof(uint16_t));
+        info->score = score;
+        info->completedDepth = depth;
+
+        if (stopFlag(&shared->stopped)) break;
+        if (info->id != 0) continue;
+
+        if (shared->verbose) {
+            printSearchInfo(info, shared->threadCount);
+        }
+
+        // Stop once a mate has been found.
+        if (abs(score) >= MATE_SCORE - MAX_SEARCH_PLY) break;
+
+        // On a clock, don't start an iteration that would likely run past the time aimed for: each one takes about
+        // as long again as all the ones before it. A best move that has held for a few iterations gets less time,
+        // one that has just changed more.
+        if (shared->targetTime > 0) {
+            double scale = stabilityScales[(stableIterations < 4) ? stableIterations : 4];
+            if ((currentTime() - shared->start) * ITERATION_GROWTH >= shared->targetTime * scale) break;
+        }
+    }
+
+    if (info->id == 0) raiseStopFlag(&shared->stopped);
+    return NULL;
+}
+
+// Work out how long a search may take: the time it aims for on a clock, 0 without one, and the hard limit
+// it is cut off at, 0 for none. A fixed move time is a hard limit alone.
+void allocateTime(struct engineOptions options, double* target, double* limit) {
+    *target = 0;
+    *limit = (options.moveTime > 0) ? options.moveTime : 0;
+    if (options.clock <= 0) return;
+
+    // Aim for an even share of what is left, plus most of the increment, which comes back after the move.
+    double available = (options.clock - MOVE_OVERHEAD > 0.001) ? options.clock - MOVE_OVERHEAD : 0.001;
+    int moves = (options.movesToGo > 0 && options.movesToGo < DEFAULT_MOVES_TO_GO) ? options.movesToGo : DEFAULT_MOVES_TO_GO;
+    double aim = available / moves + options.increment * 3 / 4;
+    double hard = (aim * HARD_LIMIT_FACTOR < available * HARD_LIMIT_SHARE) ? aim * HARD_LIMIT_FACTOR : available * HARD_LIMIT_SHARE;
+
+    if (*limit == 0 || hard < *limit) *limit = hard;
+    *target = (aim < *limit) ? aim : *limit;
+}
+
+// Find the best move with the engine's threads, searching until its depth or time budget runs out.
+// A move is always returned once the first iteration is done, or 0 if there are no legal moves.
+// The table may be NULL to search without one, and pawnTables, from createPawnTables for as many threads,
+// NULL to work the pawns out every time. The search also ends early once *stopRequest is set.
+struct searchResult searchBestMove(struct chessBoard* board, struct transpositionTable* table, struct pawnTable* pawnTables,
+                                   struct engineOptions options, bool verbose, bool* stopRequest) {
+    struct searchShared shared;
+    struct searchInfo* threads = NULL;
+    struct chessBoard* boards = NULL;
+    struct searchResult result = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    int threadCount = (options.threads > 1) ? options.threads : 1;
+    if (posix_memalign((void**)&threads, 64, threadCount * sizeof(struct searchInfo)) != 0
+        || posix_memalign((void**)&boards, 64, threadCount * sizeof(struct chessBoard)) != 0) {
+        free(threads);
+        return result;
+    }
+    memset(threads, 0, threadCount * sizeof(struct searchInfo));
+
+    // Each thread keeps its own pawn structure table, so they never wait on each other for it.
+    // Only the counts start again; the structures stay good for the next search.
+    for (int i = 0; i < threadCount && pawnTables != NULL; i++) {
+        threads[i].pawns = &pawnTables[i];
+        threads[i].pawns->probes = 0;
+        threads[i].pawns->hits = 0;
+    }
+
+    shared.table = table;
+    shared.maxDepth = (options.depth > 0 && options.depth < MAX_SEARCH_PLY) ? options.depth : MAX_SEARCH_PLY - 1;
+    double limit;
+    allocateTime(options, &shared.targetTime, &limit);
+    shared.start = currentTime();
+    shared.deadline = shared.start + ((limit > 0) ? limit : 1e9);
+    shared.verbose = verbose;
+    shared.pinThreads = options.pinThreads;
+    shared.threadCount = threadCount;
+    shared.features = options.features;
+    shared.stopRequest = stopRequest;
+    shared.stopped = false;
+
+    // Entries from earlier searches are replaced first.
+    if (table != NULL) table->age++;
+
+    // If a thread can't be started, the search goes ahead with those that were,
+    // and if none were, it runs on this one instead.
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        boards[i] = *board;
+        threads[i].shared = &shared;
+        threads[i].board = &boards[i];
+        threads[i].id = i;
+        if (pthread_create(&threads[i].thread, NULL, searchThread, &threads[i]) != 0) break;
+        started++;
+    }
+    if (started == 0) searchThread(&threads[0]);
+    for (int i = 0; i < threadCount; i++) {
+        if (i < started) pthread_join(threads[i].thread, NULL);
+        result.nodes += threads[i].nodes;
+        if (threads[i].pawns != NULL) {
+            result.pawnProbes += threads[i].pawns->probes;
+            result.pawnHits += threads[i].pawns->hits;
+        }
+    }
+
+    result.move = (threads[0].rootPvLength > 0) ? threads[0].rootPv[0] : 0;
+    result.score = threads[0].score;
+    result.depth = threads[0].completedDepth;
+    result.time = currentTime() - shared.start;
+    result.limit = limit;
+
+    // Fall back on any legal move if the clock ran out before the first iteration finished.
+    if (result.move == 0) {
+        struct moveList legal;
+        generateLegalMoves(board, &legal);
+        if (legal.count > 0) result.move = legal.moves[0];
+    }
+
+    free(boards);
+    free(threads);
+    return result;
+}
+
+// Size of the area the game draws in, in terminal cells.
+#define SCREEN_ROWS 40
+#define SCREEN_COLUMNS 96
+
+// One terminal cell: a UTF-8 character and the SGR background code it is drawn on (0 for none).
+struct screenCell
+{
+    char glyph[4];
+    uint8_t length;
+    uint8_t background;
+};
+
+// The frame being drawn, the frame the terminal is showing, and the buffer the difference is written out from.
+// Drawing goes into cells as if printed from the top left of a cleared terminal, so the drawing code can
+// keep using newlines and colour escapes, and flushScreen only sends the cells that changed.
+struct screen
+{
+    struct screenCell cells[SCREEN_ROWS][SCREEN_COLUMNS];
+    struct screenCell shown[SCREEN_ROWS][SCREEN_COLUMNS];
+    int row;
+    int column;
+    uint8_t background;
+    bool cleared;
+    char output[SCREEN_ROWS * SCREEN_COLUMNS * 24];
+    int outputLength;
+};
+
+struct screen terminalScreen;
+
+// Set every cell to a space with no background.
+void blankCells(struct screenCell cells[SCREEN_ROWS][SCREEN_COLUMNS]) {
+    for (int row = 0; row < SCREEN_ROWS; row++) {
+        for (int column = 0; column < SCREEN_COLUMNS; column++) {
+            cells[row][column] = (struct screenCell){{' '}, 1, 0};
+        }
+    }
+}
+
+// Start a new frame: every cell blank, drawing from the top left.
+void beginFrame(void) {
+    struct screen* screen = &terminalScreen;
 
-    if (friendlyPiece) return false;
-    
-    if (isEmpty(board, targetX, targetY)) {
-        if (piece == 'P') {
-            if (positionY == 3 && whitePassant && abs(targetX - positionX) == 1) {
-                return true;
-            }
-            else {
-                return false;
-            }
-        }
-        else if (piece == 'p') {
-            if (positionY == 4 && blackPassant && abs(targetX - positionX) == 1) {
-                return true;
-            }
-            else {
-                return false;
-            }
-        }
-        else {
-            return false;
+    blankCells(screen->cells);
+    screen->row = 0;
+    screen->column = 0;
+    screen->background = 0;
+}
+
+// Pick up the background from the parameters of an SGR escape, such as "0;100".
+void applyColourEscape(struct screen* screen, const char* parameters, int length) {
+    int value = 0;
+
+    for (int i = 0; i <= length; i++) {
+        if (i < length && parameters[i] >= '0' && parameters[i] <= '9') {
+            value = value * 10 + parameters[i] - '0';
+            continue;
         }
-    }
-    switch (piece) {
-        case 'E': // Double Step Pawn White
-        case 'P': // Pawn White
-        case 'A': // En Passant White
-            return (targetY + 1 == positionY && abs(targetX - positionX) == 1);
-            break;
-        case 'e': // Double Step Pawn Black
-        case 'p': // Pawn Black
-        case 'a': // En Passant Black
-            return (targetY - 1 == positionY && abs(targetX - positionX) == 1);
-            break;
-        case 'B': // Bishop Black
-        case 'b': // Bishop White
-            return bishopAttack(board, positionX, positionY, targetX, targetY);
-            break;
-        case 'R': // Rook White
-        case 'r': // Rook Black
-            return rookAttack(board, positionX, positionY, targetX, targetY);
-            break;
-        case 'Q': // Queen White
-        case 'q': // Queen Black
-            return (bishopAttack(board, positionX, positionY, targetX, targetY) || rookAttack(board, positionX, positionY, targetX, targetY));
-            break;
-        case 'K':
-        case 'k':
-            return kingMove(board, piece, targetX, targetY, positionX, positionY, turn);
-        case 'N':
-        case 'n':
-            return knightMove(board, targetX, targetY, positionX, positionY);
-        default:
-            return false;
+        if (value == 0) screen->background = 0;
+        else if ((value >= 40 && value <= 47) || (value >= 100 && value <= 107)) screen->background = value;
+        value = 0;
     }
 }
 
-// Check if castling is legal for a rook or a king, given its position and a target location.
-bool isCastleLegal(struct gameState state, char* board, char castlePiece, int targetX, int targetY, int positionX, int positionY, char turn) {
+// Draw formatted text into the frame, the way printf would print it onto a cleared terminal.
+void screenPrintf(const char* format, ...) {
+    struct screen* screen = &terminalScreen;
+    char text[1024];
+    va_list arguments;
 
-    bool rookSelectedQCW = false;
-    bool rookSelectedKCW = false;
-    bool rookSelectedQCB = false;
-    bool rookSelectedKCB = false;
+    va_start(arguments, format);
+    int length = vsnprintf(text, sizeof(text), format, arguments);
+    va_end(arguments);
+    if (length > (int)sizeof(text) - 1) length = sizeof(text) - 1;
 
-    if (castlePiece == 'R') {
-        if (positionX == 7 && positionY == 7) {
-            rookSelectedKCW = true;
+    for (int i = 0; i < length; i++) {
+        unsigned char byte = text[i];
+
+        if (byte == '\n') {
+            screen->row++;
+            screen->column = 0;
         }
-        else if (positionX == 0 && positionY == 7) {
-            rookSelectedQCW = true;
+        else if (byte == '\e' && text[i + 1] == '[') {
+            int start = i + 2;
+            int end = start;
+            while (end < length && !(text[end] >= '@' && text[end] <= '~')) end++;
+            if (end < length && text[end] == 'm') applyColourEscape(screen, &text[start], end - start);
+            i = end;
         }
-    }
-    else if (castlePiece == 'r') {
-        if (positionX == 0 && positionY == 0) {
-            rookSelectedQCB = true;
+        else if (byte == '\e') {
+            // Any other escape is two bytes long, as far as the terminal is concerned.
+            i++;
         }
-        else if (positionX == 7 && positionY == 0) {
-            rookSelectedKCB = true;
+        else {
+            int size = (byte >= 0xF0) ? 4 : (byte >= 0xE0) ? 3 : (byte >= 0xC0) ? 2 : 1;
+            if (i + size > length) break;
+
+            if (screen->row < SCREEN_ROWS && screen->column < SCREEN_COLUMNS) {
+                struct screenCell* cell = &screen->cells[screen->row][screen->column];
+                memcpy(cell->glyph, &text[i], size);
+                cell->length = size;
+                cell->background = screen->background;
+            }
+            screen->column++;
+            i += size - 1;
         }
     }
+}
 
-    if (whoseTurn(castlePiece) == turn) {
-        switch(castlePiece) {
-            case 'R':
-                if (rookSelectedQCW && *state.queensideCastleWhite) {
-                    if (isEmpty(board, 1, 7) && isEmpty(board, 2, 7) && isEmpty(board, 3, 7)) {
-                        if (targetX == 3 && targetY == 7 && isQueensideCastleWhiteLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                else if (rookSelectedKCW && *state.kingsideCastleWhite) {
-                    if (isEmpty(board, 6, 7) && isEmpty(board, 5, 7)) {
-                        if (targetX == 5 && targetY == 7 && isKingsideCastleWhiteLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                return false;
-            case 'r':
-                if (rookSelectedQCB && *state.queensideCastleBlack) {
-                    if (isEmpty(board, 1, 0) && isEmpty(board, 2, 0) && isEmpty(board, 3, 0)) {
-                        if (targetX == 3 && targetY == 0 && isQueensideCastleBlackLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                else if (rookSelectedKCB && *state.kingsideCastleBlack) {
-                    if (isEmpty(board, 6, 0) && isEmpty(board, 5, 0)) {
-                        if (targetX == 5 && targetY == 0 && isKingsideCastleBlackLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                return false;
-            case 'K':
-                if (*state.queensideCastleWhite) {
-                    if (isEmpty(board, 1, 7) && isEmpty(board, 2, 7) && isEmpty(board, 3, 7)) {
-                        if (targetX == 2 && targetY == 7 && isQueensideCastleWhiteLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                if (*state.kingsideCastleWhite) {
-                    if (isEmpty(board, 6, 7) && isEmpty(board, 5, 7)) {
-                        if (targetX == 6 && targetY == 7 && isKingsideCastleWhiteLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                return false;
-            case 'k':
-                if (*state.queensideCastleBlack) {
-                    if (isEmpty(board, 1, 0) && isEmpty(board, 2, 0) && isEmpty(board, 3, 0)) {
-                        if (targetX == 2 && targetY == 0 && isQueensideCastleBlackLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                if (*state.kingsideCastleBlack) {
-                    if (isEmpty(board, 6, 0) && isEmpty(board, 5, 0)) {
-                        if (targetX == 6 && targetY == 0 && isKingsideCastleBlackLegal(board, turn)) {
-                            return true;
-                        }
-                    }
-                }
-                return false;
-            default:
-                return false;
+// Add bytes to the pending output.
+void appendOutput(struct screen* screen, const char* bytes, int length) {
+    memcpy(&screen->output[screen->outputLength], bytes, length);
+    screen->outputLength += length;
+}
+
+// Send the cells that changed since the last flush to the terminal in a single write.
+// The first flush clears the terminal and hides its cursor instead of spawning clear.
+void flushScreen(void) {
+    struct screen* screen = &terminalScreen;
+    char escape[16];
+    int cursorRow = -1;
+    int cursorColumn = -1;
+    int background = -1;
+
+    screen->outputLength = 0;
+    if (!screen->cleared) {
+        appendOutput(screen, "\e[0m\e[H\e[2J\e[?25l", 17);
+        blankCells(screen->shown);
+        screen->cleared = true;
+    }
+
+    for (int row = 0; row < SCREEN_ROWS; row++) {
+        for (int column = 0; column < SCREEN_COLUMNS; column++) {
+            struct screenCell* cell = &screen->cells[row][column];
+            struct screenCell* shown = &screen->shown[row][column];
+
+            if (cell->length == shown->length && cell->background == shown->background
+                && memcmp(cell->glyph, shown->glyph, cell->length) == 0) {
+                continue;
+            }
+
+            if (row != cursorRow || column != cursorColumn) {
+                appendOutput(screen, escape, sprintf(escape, "\e[%d;%dH", row + 1, column + 1));
+            }
+            if (cell->background != background) {
+                if (cell->background == 0) appendOutput(screen, "\e[0m", 4);
+                else appendOutput(screen, escape, sprintf(escape, "\e[0;%dm", cell->background));
+                background = cell->background;
+            }
+            appendOutput(screen, cell->glyph, cell->length);
+
+            *shown = *cell;
+            cursorRow = row;
+            cursorColumn = column + 1;
         }
     }
-    return false;
+
+    // Leave the terminal without a background colour, for anything printed after the game.
+    if (background > 0) appendOutput(screen, "\e[0m", 4);
+
+    for (int written = 0; written < screen->outputLength;) {
+        ssize_t count = write(STDOUT_FILENO, screen->output + written, screen->outputLength - written);
+        if (count <= 0) break;
+        written += count;
+    }
 }
 
 // Color codes for the game board.
-void printTile(char color, char* symbol) {
+void printTile(char color, const char* symbol) {
     switch(color) {
         case 'n': // black
-            printf("\e[40m %s \e[0m", symbol);  
+            screenPrintf("\e[40m %s \e[0m", symbol);  
             break;
         case 'r': // red
-            printf("\e[41m %s \e[0m", symbol);
+            screenPrintf("\e[41m %s \e[0m", symbol);
             break;
         case 'g': // green
-            printf("\e[42m %s \e[0m", symbol);
+            screenPrintf("\e[42m %s \e[0m", symbol);
             break;
         case 'y': // yellow
-            printf("\e[43m %s \e[0m", symbol);
+            screenPrintf("\e[43m %s \e[0m", symbol);
             break;
         case 'b': // blue
-            printf("\e[44m %s \e[0m", symbol);
+            screenPrintf("\e[44m %s \e[0m", symbol);
             break;
         case 'm': // magenta
-            printf("\e[45m %s \e[0m", symbol);
+            screenPrintf("\e[45m %s \e[0m", symbol);
             break;
         case 'c': // cyan
-            printf("\e[46m %s \e[0m", symbol);
+            screenPrintf("\e[46m %s \e[0m", symbol);
             break;
         case 'w': // white
-            printf("\e[47m %s \e[0m", symbol);
+            screenPrintf("\e[47m %s \e[0m", symbol);
             break;
         default:
             ;
     }
 }
 
+// Squares a piece on the board can move to, attack and castle to, found for one position.
+struct pieceHighlights
+{
+    uint64_t key;
+    int square;
+    uint64_t moves;
+    uint64_t attacks;
+    uint64_t castles;
+};
+
+// What the board highlights, kept between frames: the moves of the hovered and selected pieces,
+// and the pieces giving check to each king. Each part is only worked out again when its
+// position or square changes, so redrawing the same position costs no legality checks.
+struct highlightCache
+{
+    struct pieceHighlights hover;
+    struct pieceHighlights selected;
+    uint64_t checkKey;
+    uint64_t checkWhite;
+    uint64_t checkBlack;
+};
+
+// Mark every position stale, so the next frame works each part out again.
+void clearHighlights(struct highlightCache* cache) {
+    cache->hover.square = OFF_BOARD - 1;
+    cache->selected.square = OFF_BOARD - 1;
+    cache->checkKey = ~cache->checkKey;
+}
+
+// Find the squares the piece at (x, y) can move to, attack and castle to, unless they are already known.
+void findPieceHighlights(struct gameState state, struct pieceHighlights* highlights, int x, int y) {
+    int square = validBoardPosition(x, y) ? y * BOARD_SIZE + x : OFF_BOARD;
+
+    if (highlights->key == state.board->key && highlights->square == square) return;
+
+    highlights->key = state.board->key;
+    highlights->square = square;
+    highlights->moves = 0;
+    highlights->attacks = 0;
+    highlights->castles = 0;
+
+    char piece = getGridItem(state.board, x, y);
+    if (pieceType(piece) == NO_PIECE) return;
+
+    for (int targetY = 0; targetY < BOARD_SIZE; targetY++) {
+        for (int targetX = 0; targetX < BOARD_SIZE; targetX++) {
+            uint64_t bit = SQUARE_BIT(targetY * BOARD_SIZE + targetX);
+
+            if (isMoveLegal(state.board, piece, targetX, targetY, x, y)) {
+                highlights->moves |= bit;
+            }
+            if (isAttackLegal(state.board, piece, targetX, targetY, x, y)) {
+                highlights->attacks |= bit;
+            }
+            if (isCastleLegal(state.board, piece, targetX, targetY, x, y, state.currentPlayer)) {
+                highlights->castles |= bit;
+            }
+        }
+    }
+}
+
+// Bring the highlights up to date with the board, the cursor and the selection.
+void updateHighlights(struct gameState state) {
+    struct highlightCache* cache = state.highlights;
+
+    findPieceHighlights(state, &cache->hover, state.game->ui.cursorX, state.game->ui.cursorY);
+    findPieceHighlights(state, &cache->selected, state.game->ui.selectedX, state.game->ui.selectedY);
+
+    if (cache->checkKey == state.board->key) return;
+
+    cache->checkKey = state.board->key;
+    cache->checkWhite = 0;
+    cache->checkBlack = 0;
+
+    int kingWhite = state.board->kingSquare[WHITE];
+    int kingBlack = state.board->kingSquare[BLACK];
+
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            char processPiece = getGridItem(state.board, x, y);
+            if (pieceType(processPiece) == NO_PIECE) continue;
+
+            if (isAttackLegal(state.board, processPiece, kingWhite % BOARD_SIZE, kingWhite / BOARD_SIZE, x, y)) {
+                cache->checkWhite |= SQUARE_BIT(y * BOARD_SIZE + x);
+            }
+            if (isAttackLegal(state.board, processPiece, kingBlack % BOARD_SIZE, kingBlack / BOARD_SIZE, x, y)) {
+                cache->checkBlack |= SQUARE_BIT(y * BOARD_SIZE + x);
+            }
+        }
+    }
+}
+
 // Display the game board in the terminal.
 void renderBoard(struct gameState state) {
 
@@ -1055,36 +3762,35 @@ void renderBoard(struct gameState state) {
     char blackSpace = 'B';
     char init = blackSpace;
 
-    *(state.whiteCheck) = PERSISTENT_FALSE;
-    *(state.blackCheck) = PERSISTENT_FALSE;
+    // The rules are only consulted when the position, hovered square or selection changed since the last frame.
+    updateHighlights(state);
+    struct highlightCache* cache = state.highlights;
+    char hoverPiece = getGridItem(state.board, state.game->ui.cursorX, state.game->ui.cursorY);
 
     for (int y = 0; y < BOARD_SIZE; y++) {
-        printf("\e[0m  %d ", 8 - y);
+        screenPrintf("\e[0m  %d ", 8 - y);
 
         for (int x = 0; x < BOARD_SIZE; x++) {
-            char hoverPiece = getGridItem(state.board, state.cursorX, state.cursorY);
-            char selectedPiece = getGridItem(state.board, *state.selectedX, *state.selectedY);
-            char processPiece = getGridItem(state.board, x, y);
+            uint64_t bit = SQUARE_BIT(y * BOARD_SIZE + x);
 
-            bool hoverMoveLegal = isMoveLegal(state.board, hoverPiece, x, y, state.cursorX, state.cursorY, state.currentPlayer);
-            bool selectedMoveLegal = isMoveLegal(state.board, selectedPiece, x, y, *state.selectedX, *state.selectedY, state.currentPlayer);
+            bool hoverMoveLegal = (cache->hover.moves & bit) != 0;
+            bool selectedMoveLegal = (cache->selected.moves & bit) != 0;
 
-            bool hoverAttackLegal = isAttackLegal(state.board, hoverPiece, x, y, state.cursorX, state.cursorY, state.currentPlayer);
-            bool selectedAttackLegal = isAttackLegal(state.board, selectedPiece, x, y, *state.selectedX, *state.selectedY, state.currentPlayer);
+            bool hoverAttackLegal = (cache->hover.attacks & bit) != 0;
+            bool selectedAttackLegal = (cache->selected.attacks & bit) != 0;
 
-            bool checkWhite = isAttackLegal(state.board, processPiece, *state.kingWhiteX, *state.kingWhiteY, x, y, state.currentPlayer);
-            bool checkBlack = isAttackLegal(state.board, processPiece, *state.kingBlackX, *state.kingBlackY, x, y, state.currentPlayer);
-            
-            bool hoverCastleLegal = isCastleLegal(state, state.board, hoverPiece, x, y, state.cursorX, state.cursorY, state.currentPlayer);
-            bool selectedCastleLegal = isCastleLegal(state, state.board, selectedPiece, x, y, *state.selectedX, *state.selectedY, state.currentPlayer);
+            bool checkWhite = (cache->checkWhite & bit) != 0;
+            bool checkBlack = (cache->checkBlack & bit) != 0;
+
+            bool hoverCastleLegal = (cache->hover.castles & bit) != 0;
+            bool selectedCastleLegal = (cache->selected.castles & bit) != 0;
 
             bool notTurn = (whoseTurn(hoverPiece) != state.currentPlayer);
             
-            bool cursorFocus = (state.cursorX == x && state.cursorY == y);
-            bool selectedFocus = *state.selectMode && (*state.selectedX == x && *state.selectedY == y);
+            bool cursorFocus = (state.game->ui.cursorX == x && state.game->ui.cursorY == y);
+            bool selectedFocus = state.game->ui.selectMode && (state.game->ui.selectedX == x && state.game->ui.selectedY == y);
             
             if (checkWhite) {
-                *(state.whiteCheck) = PERSISTENT_TRUE;
                 if (selectedAttackLegal) {
                     printTile('m', getSymbol(state.board, x, y));
                 }
@@ -1096,7 +3802,6 @@ void renderBoard(struct gameState state) {
                 }
             }
             else if (checkBlack) {
-                *(state.blackCheck) = PERSISTENT_TRUE;
                 if (selectedAttackLegal) {
                     printTile('m', getSymbol(state.board, x, y));
                 }
@@ -1110,7 +3815,7 @@ void renderBoard(struct gameState state) {
             // If the tile is on the user cursor.
             else if (cursorFocus) {
                 // If the user is in select mode.
-                if (*state.selectMode) {
+                if (state.game->ui.selectMode) {
                     // If the user is hovering over their selected piece.
                     if (selectedFocus) {
                         printTile('c', getSymbol(state.board, x, y));
@@ -1147,7 +3852,7 @@ void renderBoard(struct gameState state) {
                 swapChar(&whiteSpace, &blackSpace);
             }
             else {
-                if (*state.selectMode) {
+                if (state.game->ui.selectMode) {
                     // Glow the player's selected tile.
                     if (selectedFocus) {
                         printTile('c', getSymbol(state.board, x, y));
@@ -1166,11 +3871,11 @@ void renderBoard(struct gameState state) {
                     }
                     // Print board pattern.
                     else if (init == whiteSpace) {
-                        printf("\e[40m %s \e[0m", getSymbol(state.board, x, y)); 
+                        screenPrintf("\e[40m %s \e[0m", getSymbol(state.board, x, y)); 
                     }
                     // If not, show the contents according to pointer offset.
                     else {
-                        printf("\e[0;100m %s \e[0m", getSymbol(state.board, x, y)); 
+                        screenPrintf("\e[0;100m %s \e[0m", getSymbol(state.board, x, y)); 
                     }   
                 }
                 else if (hoverCastleLegal) {
@@ -1190,12 +3895,12 @@ void renderBoard(struct gameState state) {
                 else {
                     // Print the board background, if the information is unimportant.
                     if (init == whiteSpace) {
-                        printf("\e[40m %s \e[0m", getSymbol(state.board, x, y)); 
+                        screenPrintf("\e[40m %s \e[0m", getSymbol(state.board, x, y)); 
                         
                     }
                     // Print the board in an alternating pattern.
                     else {
-                        printf("\e[0;100m %s \e[0m", getSymbol(state.board, x, y)); 
+                        screenPrintf("\e[0;100m %s \e[0m", getSymbol(state.board, x, y)); 
                     }
                 }
                 swapChar(&whiteSpace, &blackSpace);      
@@ -1203,10 +3908,10 @@ void renderBoard(struct gameState state) {
         }
         // Swap the alternating checkered pattern of the board after every row.
         swapChar(&whiteSpace, &blackSpace);
-        printf("\e[0m %d  \n", 8 - y);
+        screenPrintf("\e[0m %d  \n", 8 - y);
     }
     // Render algebraic notation letters.
-    printf("\e[0m     a  b  c  d  e  f  g  h     ");
+    screenPrintf("\e[0m     a  b  c  d  e  f  g  h     ");
 }
 
 // Display the game board in the terminal.
@@ -1216,484 +3921,466 @@ void renderDummyBoard() {
     char blackSpace = 'B';
     char init = blackSpace;
 
-    printf("\n\e[0m     a  b  c  d  e  f  g  h     \n");
+    screenPrintf("\n\e[0m     a  b  c  d  e  f  g  h     \n");
 
     for (int y = 0; y < BOARD_SIZE; y++) {
-        printf("\e[0m  %d ", 8 - y);
+        screenPrintf("\e[0m  %d ", 8 - y);
         for (int x = 0; x < BOARD_SIZE; x++) {
             if (init == whiteSpace) {
-                printf("\e[40m   \e[0m", '0'); 
+                screenPrintf("\e[40m   \e[0m", '0'); 
             }
             else {
-                printf("\e[0;100m   \e[0m"); 
+                screenPrintf("\e[0;100m   \e[0m"); 
             }
             swapChar(&whiteSpace, &blackSpace);
         }
         
         // Swap the alternating checkered pattern of the board after every row.
         swapChar(&whiteSpace, &blackSpace);
-        printf("\e[0m %d  \n", 8 - y);
+        screenPrintf("\e[0m %d  \n", 8 - y);
     }
     // Render algebraic notation letters.
-    printf("\e[0m     a  b  c  d  e  f  g  h     ");
+    screenPrintf("\e[0m     a  b  c  d  e  f  g  h     ");
 }
 
 // Check if Castling is possible, then show feedback to controls if possible.
 void printCastle(struct gameState state) {
 
-    bool showCastleHoverOverlay = false;
-    bool showCastleSelectOverlay = false;
+    // Detect if Castling is legal with the hovered or selected piece.
+    updateHighlights(state);
+    bool showCastleHoverOverlay = (state.highlights->hover.castles != 0);
+    bool showCastleSelectOverlay = (state.highlights->selected.castles != 0);
 
-    // Detect if Castling is legal with any pieces.
-    for (int y = 0; y < BOARD_SIZE; y++) {
-        for (int x = 0; x < BOARD_SIZE; x++) {
-            char hoverPiece = getGridItem(state.board, state.cursorX, state.cursorY);
-            char selectedPiece = getGridItem(state.board, *state.selectedX, *state.selectedY);
-            
-            bool hoverCastleLegal = isCastleLegal(state, state.board, hoverPiece, x, y, state.cursorX, state.cursorY, state.currentPlayer);
-            bool selectedCastleLegal = isCastleLegal(state, state.board, selectedPiece, x, y, *state.selectedX, *state.selectedY, state.currentPlayer);
+    // If the player can castle, report this in the controls.
+    if (state.game->ui.selectMode && showCastleSelectOverlay) {
+        screenPrintf("\n           c - CASTLE \n\n");
+        
+    }
+    else if (showCastleHoverOverlay) {
+        screenPrintf("\n           c - CASTLE \n\n");
+    }
+    else {
+        screenPrintf("\n\n");
+    }
+}
 
-            if (hoverCastleLegal) {
-                showCastleHoverOverlay = true;
-            }
-            if (selectedCastleLegal) {
-                showCastleSelectOverlay = true;
-            }
+// Ask the player which piece a pawn promotes to.
+int pawnPromotion(void) {
+   
+    screenPrintf("\n\n         PAWN PROMOTION    ");
+    screenPrintf("\n           b - bishop      ");
+    screenPrintf("\n           k - knight      ");
+    screenPrintf("\n           q - queen       ");
+    screenPrintf("\n           r - rook        ");
+    flushScreen();
+
+    while(1) {
+        switch(getch()) {
+            case 'B':
+            case 'b':
+                return BISHOP;
+            case 'K':
+            case 'k':
+                return KNIGHT;
+            case 'Q':
+            case 'q':
+                return QUEEN;
+            case 'R':
+            case 'r':
+                return ROOK;
+            default:
+                ;
         }
     }
+}
 
-    // If the player can castle, report this in the controls.
-    if (*state.selectMode && showCastleSelectOverlay) {
-        printf("\n           c - CASTLE \n\n");
-        
-    }
-    else if (~(*state.selectMode) && showCastleHoverOverlay) {
-        printf("\n           c - CASTLE \n\n");
+// 
+int printGame(struct gameState state) {
+
+    // Draw a fresh frame; only what changed since the last one is sent to the terminal.
+    beginFrame();
+
+    // Print the header.
+    screenPrintf("\n\e[0;107m                                ");
+    screenPrintf("\n\e[0;100m           C99 CHESS            ");
+    screenPrintf("\n\e[0;100m         by ArtisanLRO          ");
+    screenPrintf("\n\e[0;107m                                ");
+    screenPrintf("\n\e[0m     a  b  c  d  e  f  g  h     \n");
+    
+    // Render the game board.
+    renderBoard(state);
+
+    // Print player information.
+    if (state.currentPlayer == 'X') {
+        screenPrintf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");
+        screenPrintf("\n\e[0m       Turn %d - White Turn    ", state.turnCount);
+        screenPrintf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");
     }
     else {
-        printf("\n\n");
+        screenPrintf("\n\e[0;100m□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□\e[0m");
+        screenPrintf("\n\e[0m       Turn %d - Black Turn    ", state.turnCount);
+        screenPrintf("\n\e[0;100m□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□\e[0m");
+    }
+    
+    // Show controls
+    screenPrintf("\n\e                               \e[0m");
+    screenPrintf("\n        ijkl - NAVIGATE");
+    screenPrintf("\n      x - SELECT  p - DROP\e[0m");
+    screenPrintf("\n       u - UNDO  r - REDO\e[0m");
+    screenPrintf("\n         f - SHOW FEN\e[0m");
+    
+    // Show if Castling is possible.
+    printCastle(state);
+
+    // Show if Selection Mode is on.
+    if (state.game->ui.selectMode) {
+        screenPrintf("         SELECT MODE ON");
+    }
+
+    if (state.highlights->checkWhite) {
+        screenPrintf("\n       CHECK ON KING WHITE");
+    }
+
+    if (state.highlights->checkBlack) {
+        screenPrintf("\n       CHECK ON KING BLACK");
+    }
+
+    flushScreen();
+
+    return 1;
+}
+
+// Show how the game ended, with the side to move being the one that is mated.
+void printGameResult(int result, int side) {
+    switch(result) {
+        case GAME_CHECKMATE:
+            screenPrintf("\n\n     CHECKMATE - %s WINS", (side == WHITE) ? "BLACK" : "WHITE");
+            break;
+        case GAME_STALEMATE:
+            screenPrintf("\n\n        STALEMATE - DRAW");
+            break;
+        case GAME_INSUFFICIENT_MATERIAL:
+            screenPrintf("\n\n  DRAW - INSUFFICIENT MATERIAL");
+            break;
+        case GAME_REPETITION:
+            screenPrintf("\n\n  DRAW - THREEFOLD REPETITION");
+            break;
+        case GAME_FIFTY_MOVES:
+            screenPrintf("\n\n     DRAW - FIFTY-MOVE RULE");
+            break;
+        case GAME_MOVE_LIMIT:
+            screenPrintf("\n\n   GAME OVER - TOO MANY MOVES");
+            break;
+        default:
+            ;
+    }
+    screenPrintf("\n   u - UNDO  OTHER KEYS - QUIT");
+    flushScreen();
+}
+
+// Copy the turn of the board into the game state, and drop any selection.
+void syncGameState(struct gameState* state) {
+    struct chessBoard* board = state->board;
+
+    state->currentPlayer = (board->side == WHITE) ? PLAYER_1 : PLAYER_2;
+    state->lastPlayer = (board->historyCount > 0) ? ((board->side == WHITE) ? PLAYER_2 : PLAYER_1) : '.';
+
+    state->game->ui.selectMode = false;
+    state->game->ui.selectedX = OFF_BOARD;
+    state->game->ui.selectedY = OFF_BOARD;
+}
+
+// Pack the working board back into the stored game, once a move has changed its position.
+void storeGame(struct gameState* state) {
+    packPosition(state->board, &state->game->position);
+}
+
+// Set the working board up from the stored game, to carry on playing it. Moves made before it was stored
+// can't be taken back, and there is nothing to redo.
+void resumeGame(struct gameState* state) {
+    unpackPosition(state->board, &state->game->position);
+    state->redoCount = 0;
+    state->turnCount = state->board->startPly + 1;
+    syncGameState(state);
+}
+
+// Set the game to a position given in FEN, with nothing to redo. Returns false if the FEN is invalid,
+// leaving the game at its stored position, though with nothing to take back.
+bool setGamePosition(struct gameState* state, const char* fen) {
+    if (!loadFen(state->board, fen)) {
+        resumeGame(state);
+        return false;
     }
+
+    state->redoCount = 0;
+    state->turnCount = state->board->startPly + 1;
+    syncGameState(state);
+    storeGame(state);
+    return true;
 }
 
-int pawnPromotion(char* board, int positionX, int positionY, char currentPlayer) {
-   
-    printf("\n\n         PAWN PROMOTION    ");
-    printf("\n           b - bishop      ");
-    printf("\n           k - knight      ");
-    printf("\n           q - queen       ");
-    printf("\n           r - rook        ");
-    bool notSelected = PERSISTENT_TRUE;
-
-    while(notSelected) {
-        char ch = getch();
-        if (currentPlayer == 'X') {
-            switch(ch) {
-                case 'B':
-                case 'b':
-                    setGridItem(board, positionX, positionY, 'B');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                case 'K':
-                case 'k':
-                    setGridItem(board, positionX, positionY, 'N');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                case 'Q':
-                case 'q':
-                    setGridItem(board, positionX, positionY, 'Q');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                case 'r':
-                case 'R':
-                    setGridItem(board, positionX, positionY, 'R');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                default:
-                    ;
-            }
-        }
-        else {
-            switch(ch) {
-                case 'b':
-                case 'B':
-                    setGridItem(board, positionX, positionY, 'b');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                case 'k':
-                case 'K':
-                    setGridItem(board, positionX, positionY, 'n');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                case 'q':
-                case 'Q':
-                    setGridItem(board, positionX, positionY, 'q');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                case 'r':
-                case 'R':
-                    setGridItem(board, positionX, positionY, 'r');
-                    notSelected = PERSISTENT_FALSE;
-                    break;
-                default:
-                    ;
-            }
+// Find the legal move between two squares for the side to move, or 0 if there is none.
+// Castling is only matched when asked for, so a king can't castle by being dropped two squares over.
+uint16_t findGameMove(struct chessBoard* board, int from, int to, int castle) {
+    struct moveList legal;
+    generateLegalMoves(board, &legal);
+
+    for (int i = 0; i < legal.count; i++) {
+        uint16_t move = legal.moves[i];
+        bool isCastle = (MOVE_FLAGS(move) == MOVE_KING_CASTLE || MOVE_FLAGS(move) == MOVE_QUEEN_CASTLE);
+
+        if (MOVE_FROM(move) == from && MOVE_TO(move) == to && isCastle == (castle != MOVE_QUIET)) {
+            return move;
         }
     }
-}
 
-// 
-int printGame(struct gameState state) {
+    return 0;
+}
 
-    // Clear the terminal.
-    system("clear");
+// Play a move in the game, which ends the turn and clears anything that could be redone.
+void playGameMove(struct gameState* state, uint16_t move) {
+    makeMove(state->board, move);
+    state->redoCount = 0;
+    state->turnCount++;
+    syncGameState(state);
+    storeGame(state);
+}
 
-    // Print the header.
-    printf("\n\e[0;107m                                ");
-    printf("\n\e[0;100m           C99 CHESS            ");
-    printf("\n\e[0;100m         by ArtisanLRO          ");
-    printf("\n\e[0;107m                                ");
-    printf("\n\e[0m     a  b  c  d  e  f  g  h     \n");
-    
-    // Render the game board.
-    renderBoard(state);
+// The computer's search for its move in the game, on a thread of its own so the keyboard can still be read.
+struct gameSearch
+{
+    struct gameState* state;
+    struct searchResult result;
+    bool stop;
+    bool done;
+};
 
-    // Print player information.
-    if (state.currentPlayer == 'X') {
-        printf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");
-        printf("\n\e[0m       Turn %d - White Turn    ", state.turnCount);
-        printf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");
-    }
-    else {
-        printf("\n\e[0;100m□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□\e[0m");
-        printf("\n\e[0m       Turn %d - Black Turn    ", state.turnCount);
-        printf("\n\e[0;100m□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□□\e[0m");
-    }
-    
-    // Show controls
-    printf("\n\e                               \e[0m");
-    printf("\n        ijkl - NAVIGATE");
-    printf("\n      x - SELECT  p - DROP\e[0m");
-    
-    // Show if Castling is possible.
-    printCastle(state);
+// Search for the computer's move, and say when the answer is in.
+void* gameSearchThread(void* argument) {
+    struct gameSearch* search = argument;
+    search->result = searchBestMove(search->state->board, search->state->table, search->state->pawns, search->state->engine, false,
+                                    &search->stop);
+    raiseStopFlag(&search->done);
+    return NULL;
+}
 
-    // Show if Selection Mode is on.
-    if (*state.selectMode) {
-        printf("         SELECT MODE ON");
-    }
+// Find the computer's move, watching the keyboard while it thinks. Any key tells it to play the best move
+// found so far, and is used up doing so.
+uint16_t computerMove(struct gameState* state) {
+    struct gameSearch search = {state, {0}, false, false};
+    pthread_t thread;
 
-    if (*state.whiteCheck) {
-        printf("\n       CHECK ON KING WHITE");
+    // Without a thread of its own, the search just runs to its limits here.
+    if (pthread_create(&thread, NULL, gameSearchThread, &search) != 0) {
+        gameSearchThread(&search);
+        return search.result.move;
     }
-
-    if (*state.blackCheck) {
-        printf("\n       CHECK ON KING BLACK");
+    while (!stopFlag(&search.done)) {
+        if (readInput(5)) {
+            raiseStopFlag(&search.stop);
+            pendingInput.start = pendingInput.end;
+            break;
+        }
     }
-
-    // Hide the actual terminal cursor.
-    printf("\e[?25l");
-
-    return 1;
+    pthread_join(thread, NULL);
+    return search.result.move;
 }
 
 void gameLoop(struct gameState state) {
 
+    bool cursorMoved = false;
+
     while(1) {
-        printGame(state);
+        // A run of cursor moves typed ahead is applied all at once, with one redraw at the end.
+        if (!(cursorMoved && keysPending())) {
+            printGame(state);
+        }
+        cursorMoved = false;
+
+        // Once a move ends the game, only taking it back carries on. Like uciPosition, the game stops short
+        // of filling the board's move stack, leaving room for a search from the last position.
+        int result = gameResult(state.board);
+        if (result == GAME_ONGOING && state.board->historyCount >= MAX_GAME_PLY - MAX_SEARCH_PLY) {
+            result = GAME_MOVE_LIMIT;
+        }
+        if (result != GAME_ONGOING) {
+            printGameResult(result, state.board->side);
+        }
+        // Let the engine play its turn.
+        else if (state.currentPlayer == state.game->computerPlayer) {
+            screenPrintf("\n\n       COMPUTER THINKING...   ");
+            screenPrintf("\n     ANY KEY - MOVE NOW      ");
+            flushScreen();
+            uint16_t move = computerMove(&state);
+            if (move) {
+                playGameMove(&state, move);
+                continue;
+            }
+        }
 
         // Debug Castling
 
-        // printf("\n%d: QCB\n", *state.queensideCastleBlack);
-        // printf("%d: QCW\n", *state.queensideCastleWhite);
-        // printf("%d: KCB\n", *state.kingsideCastleBlack);
-        // printf("%d: KCW\n", *state.kingsideCastleWhite);
+        // screenPrintf("\n%d: CASTLE RIGHTS\n", state.board->castleRights);
 
         // Keyhandler
         char ch = getch();
+        cursorMoved = (strchr("IiKkLlJj", ch) != NULL && ch != 0);
+
+        if (result != GAME_ONGOING && ch != 'U' && ch != 'u') break;
 
         switch(ch) {
             // If on the edges, loop back to the other side of the board.
             case 'I':
             case 'i': // Cursor Up
-                if (state.cursorY == 0) state.cursorY = BOARD_SIZE - 1;
-                else state.cursorY--;
+                if (state.game->ui.cursorY == 0) state.game->ui.cursorY = BOARD_SIZE - 1;
+                else state.game->ui.cursorY--;
                 break;
             case 'K':
             case 'k': // Cursor Down
-                if (state.cursorY == BOARD_SIZE - 1) state.cursorY = 0;
-                else state.cursorY++;
+                if (state.game->ui.cursorY == BOARD_SIZE - 1) state.game->ui.cursorY = 0;
+                else state.game->ui.cursorY++;
                 break;
             case 'L':
             case 'l': // Cursor Right
-                if (state.cursorX == BOARD_SIZE - 1) state.cursorX = 0;
-                else state.cursorX++;
+                if (state.game->ui.cursorX == BOARD_SIZE - 1) state.game->ui.cursorX = 0;
+                else state.game->ui.cursorX++;
                 break;
             case 'J':
             case 'j': // Cursor Left
-                if (state.cursorX == 0) state.cursorX = BOARD_SIZE - 1;
-                else state.cursorX--;
+                if (state.game->ui.cursorX == 0) state.game->ui.cursorX = BOARD_SIZE - 1;
+                else state.game->ui.cursorX--;
                 break;
             case 'X':
             case 'x': // Select
-                state.selectedPiece = getGridItem(state.board, state.cursorX, state.cursorY);
-                bool properTurn = (whoseTurn(state.selectedPiece) == state.currentPlayer);
+                state.game->ui.selectedPiece = getGridItem(state.board, state.game->ui.cursorX, state.game->ui.cursorY);
+                bool properTurn = (whoseTurn(state.game->ui.selectedPiece) == state.currentPlayer);
 
                 // Toggle Selection Mode
-                if (*state.selectMode) {
-                    *state.selectMode = PERSISTENT_FALSE;
-                    *state.selectedX = OFF_BOARD;
-                    *state.selectedY = OFF_BOARD;
+                if (state.game->ui.selectMode) {
+                    state.game->ui.selectMode = false;
+                    state.game->ui.selectedX = OFF_BOARD;
+                    state.game->ui.selectedY = OFF_BOARD;
                 }
                 else {
                     if (properTurn) {
-                        *state.selectMode = PERSISTENT_TRUE;
-                        *state.selectedX = state.cursorX;
-                        *state.selectedY = state.cursorY;
+                        state.game->ui.selectMode = true;
+                        state.game->ui.selectedX = state.game->ui.cursorX;
+                        state.game->ui.selectedY = state.game->ui.cursorY;
                     }
                 }
                 break;
             case 'P':
             case 'p': // Drop Piece
                     ;
-                if (*state.selectMode) {
-                    bool canAttack = isAttackLegal(state.board, state.selectedPiece, state.cursorX, state.cursorY, *state.selectedX, *state.selectedY, state.currentPlayer);
-                    bool canMove = isMoveLegal(state.board, state.selectedPiece, state.cursorX, state.cursorY, *state.selectedX, *state.selectedY, state.currentPlayer);
-                    bool canResolveCheck = PERSISTENT_TRUE;
-                
-                    char movePiece = getGridItem(state.board, *state.selectedX, *state.selectedY);
-
-                    if (*state.whiteCheck) {
-                        canResolveCheck = resolveCheck(state.board, state.selectedPiece, state.cursorX, state.cursorY, *state.selectedX, *state.selectedY, *state.kingBlackX, *state.kingBlackY, state.currentPlayer);
-                    }
-                    else if (*state.blackCheck) {
-                        canResolveCheck = resolveCheck(state.board, state.selectedPiece, state.cursorX, state.cursorY, *state.selectedY, *state.selectedY, *state.kingWhiteX, *state.kingWhiteY, state.currentPlayer);
-                    }
-
-                    // Only perform this action if the player can move or attack.
-                    if ((canAttack || canMove) && canResolveCheck) {
-
-                        // Enables En Passant special rule for pawns, normally the game ignores any empty spots in attack,
-                        // so this has to be handled in a special way.
-                        if (movePiece == 'P') {
-                            if (getGridItem(state.board, state.cursorX, state.cursorY + 1) == 'a' && (getGridItem(state.board, state.cursorX, state.cursorY) == '0')) {
-                                setGridItem(state.board, state.cursorX, state.cursorY + 1, '0');
-                            }
-                        }
-                        else if (movePiece == 'p') {
-                            if (getGridItem(state.board, state.cursorX, state.cursorY - 1) == 'A' && (getGridItem(state.board, state.cursorX, state.cursorY) == '0')) {
-                                setGridItem(state.board, state.cursorX, state.cursorY - 1, '0');
-                            }
-                        }
-
-                        // If the piece moved is the king, then castling is no longer permitted.
-                        if (movePiece == 'K') {
-                            *state.kingsideCastleWhite = PERSISTENT_FALSE;
-                            *state.queensideCastleWhite = PERSISTENT_FALSE;
-                            *state.kingWhiteX = state.cursorX;
-                            *state.kingWhiteY = state.cursorY;
-                        }
-                        else if (movePiece == 'k') {
-                            *state.kingsideCastleBlack = PERSISTENT_FALSE;
-                            *state.queensideCastleBlack = PERSISTENT_FALSE;
-                            *state.kingBlackX = state.cursorX;
-                            *state.kingBlackY = state.cursorY;
-                        }
-
-                        // If the piece moved is the rook, then castling with that certain rook is no longer permitted.
-                        if (movePiece == 'R') {
-                            if (*state.selectedX == 7 && *state.selectedY == 7) {
-                                *state.kingsideCastleWhite = PERSISTENT_FALSE;
-                            }
-                            else if (*state.selectedX == 0 && *state.selectedY == 7) {
-                                *state.queensideCastleWhite = PERSISTENT_FALSE;
-                            }
-                        }
-                        else if (movePiece == 'r') {
-                            if (*state.selectedX == 0 && *state.selectedY == 0) {
-                                *state.queensideCastleBlack = PERSISTENT_FALSE;
-                            }
-                            else if (*state.selectedX == 7 && *state.selectedY == 0) {
-                                *state.kingsideCastleBlack = PERSISTENT_FALSE;
-                            }
-                        }
-
-                        // Empty the position the piece moved from.
-                        setGridItem(state.board, *state.selectedX, *state.selectedY, '0');
-
-                        // If there are any En Passant vulnerable pieces, they are no longer vulnerable in the next turn.
-                        for (int y = 0; y < BOARD_SIZE; y++) {
-                            for (int x = 0; x < BOARD_SIZE; x++) {
-                                char pieceAt = getGridItem(state.board, x, y);
-                                if (pieceAt == 'A' || pieceAt == 'a') {
-                                    setGridItem(state.board, x, y, convertSpecialPiece(pieceAt));
-                                }
-                            }
-                        }
-
-                        // Demote any double move pawns into single move pawns.                        
-                        bool doubleMove = ((movePiece == 'E' || movePiece == 'e') 
-                                            && abs(state.cursorY - *state.selectedY) == 2);
-
-                        if (doubleMove) {
-                            setGridItem(state.board, state.cursorX, state.cursorY, convertSpecialPiece(movePiece));
-                        }
-                        else if (movePiece == 'P' && state.cursorY == 0) {
-                            pawnPromotion(state.board, state.cursorX, state.cursorY, state.currentPlayer);
-                        }
-                        else if (movePiece == 'p' && state.cursorY == 7) {
-                            pawnPromotion(state.board, state.cursorX, state.cursorY, state.currentPlayer);
-                        }
-                        else {
-                            setGridItem(state.board, state.cursorX, state.cursorY, movePiece);
-                        }
-
-                        // Selection move will be toggled off at the end of the turn.
-                        *state.selectMode = PERSISTENT_FALSE;
-                        
-                        // Swap turns.
-                        state.turnCount++;
-
-                        state.lastPlayer = state.currentPlayer;
-
-                        // Can probably be changed into a pointer swap for two characters.
-                        if (state.currentPlayer == PLAYER_1) {
-                            state.currentPlayer = PLAYER_2;
-                        }
-                        else {
-                            state.currentPlayer = PLAYER_1;
+                if (state.game->ui.selectMode) {
+                    int from = state.game->ui.selectedY * BOARD_SIZE + state.game->ui.selectedX;
+                    int to = state.game->ui.cursorY * BOARD_SIZE + state.game->ui.cursorX;
+                    uint16_t move = findGameMove(state.board, from, to, MOVE_QUIET);
+
+                    // Only perform this action if the move is legal and leaves the player's king safe.
+                    if (move) {
+                        // Let the player choose the piece, then play the promotion to that piece.
+                        if (MOVE_IS_PROMOTION(move)) {
+                            move = MOVE(from, to, (MOVE_FLAGS(move) & ~3) | (pawnPromotion() - KNIGHT));
                         }
+                        playGameMove(&state, move);
                     }
                     else {
-                        printf("\n\n          ILLEGAL MOVE      ");
-                        if (*state.whiteCheck || *state.blackCheck) {
-                            printf("\n        CHECK UNRESOLVED    ");
+                        screenPrintf("\n\n          ILLEGAL MOVE      ");
+                        if (kingAttacked(state.board, state.board->side)) {
+                            screenPrintf("\n        CHECK UNRESOLVED    ");
                         }
+                        flushScreen();
                         getch();
                     }
                 }
                 else {
-                    printf("       PIECE NOT SELECTED    ");
+                    screenPrintf("       PIECE NOT SELECTED    ");
+                    flushScreen();
                     getch();
                 } 
                 break;
+            case 'C':
             case 'c': // Castle
                 ;
-                bool canCastle = isCastleLegal(state, state.board, state.selectedPiece, state.cursorX, state.cursorY, *state.selectedX, *state.selectedY, state.currentPlayer);
-                char movePiece = getGridItem(state.board, *state.selectedX, *state.selectedY);
-
-                if (*state.selectMode && canCastle) {
-                    if (movePiece == 'k' || movePiece == 'r') {
-                        *(state.kingsideCastleBlack) = PERSISTENT_FALSE;
-                        *(state.queensideCastleBlack) = PERSISTENT_FALSE; 
-                    }
-                    else if (movePiece == 'K' || movePiece == 'R') {
-                        *(state.kingsideCastleWhite) = PERSISTENT_FALSE;
-                        *(state.queensideCastleWhite) = PERSISTENT_FALSE;
+                if (state.game->ui.selectMode) {
+                    int homeRow = (state.board->side == WHITE) ? 7 : 0;
+                    int castle = MOVE_QUIET;
+                    char movePiece = getGridItem(state.board, state.game->ui.selectedX, state.game->ui.selectedY);
+
+                    // Castling is chosen by moving either the king or the rook to its castled square.
+                    if (state.game->ui.selectedY == homeRow && state.game->ui.cursorY == homeRow) {
+                        if (pieceType(movePiece) == KING && state.game->ui.cursorX == 6) castle = MOVE_KING_CASTLE;
+                        if (pieceType(movePiece) == KING && state.game->ui.cursorX == 2) castle = MOVE_QUEEN_CASTLE;
+                        if (pieceType(movePiece) == ROOK && state.game->ui.selectedX == 7 && state.game->ui.cursorX == 5) castle = MOVE_KING_CASTLE;
+                        if (pieceType(movePiece) == ROOK && state.game->ui.selectedX == 0 && state.game->ui.cursorX == 3) castle = MOVE_QUEEN_CASTLE;
                     }
 
-                    switch(movePiece) {
-                        case 'R':
-                            // QCW
-                            if (state.cursorX == 3 && state.cursorY == 7) {
-                                setGridItem(state.board, 4, 7, '0');
-                                setGridItem(state.board, 3, 7, '0');
-                                setGridItem(state.board, 2, 7, 'K');
-                                setGridItem(state.board, 1, 7, 'R');
-                                setGridItem(state.board, 0, 7, '0');
-                            }
-                            // KCW
-                            else if (state.cursorX == 5 && state.cursorY == 7) {
-                                setGridItem(state.board, 4, 7, '0');
-                                setGridItem(state.board, 5, 7, 'R');
-                                setGridItem(state.board, 6, 7, 'K');
-                                setGridItem(state.board, 7, 7, '0');
-                            }
-                        case 'r':
-                            // QCB
-                            if (state.cursorX == 3 && state.cursorY == 0) {
-                                setGridItem(state.board, 4, 0, '0');
-                                setGridItem(state.board, 3, 0, '0');
-                                setGridItem(state.board, 2, 0, 'K');
-                                setGridItem(state.board, 1, 0, 'R');
-                                setGridItem(state.board, 0, 0, '0');
-                            }
-                            // QCB
-                            else if (state.cursorX == 5 && state.cursorY == 7) {
-                                setGridItem(state.board, 4, 0, '0');
-                                setGridItem(state.board, 5, 0, 'R');
-                                setGridItem(state.board, 6, 0, 'K');
-                                setGridItem(state.board, 7, 0, '0');
-                            }
-                        case 'K':
-                            // QCW
-                            if (state.cursorX == 2 && state.cursorY == 7) {
-                                setGridItem(state.board, 4, 7, '0');
-                                setGridItem(state.board, 3, 7, '0');
-                                setGridItem(state.board, 2, 7, 'K');
-                                setGridItem(state.board, 1, 7, 'R');
-                                setGridItem(state.board, 0, 7, '0');
-                            }
-                            // KCW
-                            else if (state.cursorX == 6 && state.cursorY == 7) {\
-                                setGridItem(state.board, 4, 7, '0');
-                                setGridItem(state.board, 5, 7, 'R');
-                                setGridItem(state.board, 6, 7, 'K');
-                                setGridItem(state.board, 7, 7, '0');
-                            }
-                        case 'k':
-                            // QCB
-                            if (state.cursorX == 2 && state.cursorY == 0) {
-                                setGridItem(state.board, 4, 0, '0');
-                                setGridItem(state.board, 3, 0, '0');
-                                setGridItem(state.board, 2, 0, 'K');
-                                setGridItem(state.board, 1, 0, 'R');
-                                setGridItem(state.board, 0, 0, '0');
-                            }
-                            // QCB
-                            else if (state.cursorX == 6 && state.cursorY == 0) {
-                                setGridItem(state.board, 4, 0, '0');
-                                setGridItem(state.board, 5, 0, 'R');
-                                setGridItem(state.board, 6, 0, 'K');
-                                setGridItem(state.board, 7, 0, '0');
-                            }
-                            
-                        *state.selectMode = PERSISTENT_FALSE;
-                        *state.selectedX = -1;
-                        *state.selectedY = -1;
-                        
-                        // Swap turns.
-                        state.turnCount++;
-
-                        state.lastPlayer = state.currentPlayer;
+                    int kingFrom = homeRow * BOARD_SIZE + 4;
+                    int kingTo = homeRow * BOARD_SIZE + ((castle == MOVE_KING_CASTLE) ? 6 : 2);
+                    uint16_t move = (castle != MOVE_QUIET) ? findGameMove(state.board, kingFrom, kingTo, castle) : 0;
 
-                        // Can probably be changed into a pointer swap for two characters.
-                        if (state.currentPlayer == PLAYER_1) {
-                            state.currentPlayer = PLAYER_2;
-                        }
-                        else {
-                            state.currentPlayer = PLAYER_1;
-                        }
+                    if (move) {
+                        playGameMove(&state, move);
+                    }
+                    else {
+                        screenPrintf("\n\n          ILLEGAL MOVE      ");
+                        flushScreen();
+                        getch();
                     }
                 }
                 else {
-                    printf("       PIECE NOT SELECTED    ");
+                    screenPrintf("       PIECE NOT SELECTED    ");
+                    flushScreen();
                     getch();
                 }  
+                break;
+            case 'U':
+            case 'u': // Undo
+                // Against the computer, its reply is taken back too, so the player gets their turn again.
+                do {
+                    if (state.board->historyCount == 0) break;
+                    state.redoMoves[state.redoCount++] = state.board->history[state.board->historyCount - 1].move;
+                    unmakeMove(state.board);
+                    state.turnCount--;
+                    syncGameState(&state);
+                } while (state.currentPlayer == state.game->computerPlayer);
+                storeGame(&state);
+                break;
+            case 'R':
+            case 'r': // Redo
+                do {
+                    if (state.redoCount == 0 || state.board->historyCount >= MAX_GAME_PLY - MAX_SEARCH_PLY) break;
+                    makeMove(state.board, state.redoMoves[--state.redoCount]);
+                    state.turnCount++;
+                    syncGameState(&state);
+                } while (state.currentPlayer == state.game->computerPlayer);
+                storeGame(&state);
+                break;
+            case 'F':
+            case 'f': // Show the position as FEN
+                ;
+                char position[MAX_FEN_LENGTH];
+                writeFen(state.board, position);
+                screenPrintf("\n\n%s", position);
+                flushScreen();
+                getch();
+                break;
             default: 
                 ; // Do nothing, if not any of the controls.
         }
     }
 }
 
-void populateBoard(char* board) {
+void populateBoard(struct chessBoard* board) {
 
     // Pawns White
     for (int x = 0; x < BOARD_SIZE; x++) {
-        setGridItem(board, x, 1, 'e');
+        setGridItem(board, x, 1, 'p');
     }
     // Pawns Black
     for (int x = 0; x < BOARD_SIZE; x++) {
-        setGridItem(board, x, 6, 'E');
+        setGridItem(board, x, 6, 'P');
     }
 
     // Rooks Black
@@ -1733,10 +4420,23 @@ void populateBoard(char* board) {
             setGridItem(board, x, y, '0');
         }
     }
+
+    // White moves first, with every castling right and nothing to take En Passant.
+    board->side = WHITE;
+    board->castleRights = CASTLE_WHITE_KINGSIDE | CASTLE_WHITE_QUEENSIDE | CASTLE_BLACK_KINGSIDE | CASTLE_BLACK_QUEENSIDE;
+    board->enPassant = OFF_BOARD;
+    board->kingSquare[WHITE] = 7 * BOARD_SIZE + 4;
+    board->kingSquare[BLACK] = 4;
+    board->key = computeKey(board);
+    board->halfmoveClock = 0;
+    board->reversiblePlies = 0;
+    board->startPly = 0;
+    board->historyCount = 0;
 }
 
-// Set initial variables and start the game.
-int initialiseGame() {
+// Set initial variables and start the game, with the engine playing for computerPlayer unless it is '.'.
+// A FEN, if given, replaces the starting position.
+int initialiseGame(char computerPlayer, struct engineOptions engine, const char* fen) {
 
     // Player symbols.
     char playerFirst = 'X';
@@ -1745,57 +4445,36 @@ int initialiseGame() {
     // Necessary to record the current player's turn.
     char currentPlayer = 'X';
     char lastPlayer = '.';
-    char selectedPiece = '.';
 
     // The game starts on the first turn.
     int turnCount = 1;
 
-    // Initialise cursor position.
-    int cursorX = 4;
-    int cursorY = 7;
+    // The game is kept in a pool, as a server holding many games would keep them, though this one only ever has one.
+    struct gamePool * pool = createGamePool(1);
+    if (pool == NULL) return 1;
+    struct storedGame * game = takeGame(pool);
+    game->computerPlayer = computerPlayer;
+
+    // Initialise the cursor position, with nothing selected.
+    struct uiState ui = {4, 7, false, OFF_BOARD, OFF_BOARD, '.'};
+    game->ui = ui;
     
-    // Dynamically allocates memory for the square grid of the game board.
-    char * board = (char *)calloc(BOARD_SIZE * BOARD_SIZE, sizeof(char));
+    // Dynamically allocates memory for the square grid of the game board and its bitboards.
+    struct chessBoard * board = (struct chessBoard *)calloc(1, sizeof(struct chessBoard));
 
     // Add the starting pieces to the game board.
     populateBoard(board);
 
-    // Selection values are always changed and passed by reference.
-    int * selectMode = (int *)malloc(sizeof(int));
-    int * selectedX = (int *)malloc(sizeof(int));
-    int * selectedY = (int *)malloc(sizeof(int));
-    
-    int * kingWhiteX = (int *)malloc(sizeof(int));
-    int * kingWhiteY = (int *)malloc(sizeof(int));
-    int * kingBlackX = (int *)malloc(sizeof(int));
-    int * kingBlackY = (int *)malloc(sizeof(int));
-    
-
-    // Boolean values for castling need to be handled and modified by the game state.
-    int * queensideCastleWhite = (int *)malloc(sizeof(int));
-    int * queensideCastleBlack = (int *)malloc(sizeof(int));
-    int * kingsideCastleWhite = (int *)malloc(sizeof(int));
-    int * kingsideCastleBlack = (int *)malloc(sizeof(int));
-    
-    int * whiteCheck = (int *)malloc(sizeof(int));
-    int * blackCheck = (int *)malloc(sizeof(int));
-    
-    *(selectMode) = PERSISTENT_FALSE;
-    *(selectedX) = OFF_BOARD;
-    *(selectedY) = OFF_BOARD;
-
-    *(queensideCastleWhite) = PERSISTENT_TRUE;
-    *(queensideCastleBlack) = PERSISTENT_TRUE;
-    *(kingsideCastleWhite) = PERSISTENT_TRUE;
-    *(kingsideCastleBlack) = PERSISTENT_TRUE;
+    // Moves taken back with undo, so they can be redone.
+    uint16_t * redoMoves = (uint16_t *)malloc(MAX_GAME_PLY * sizeof(uint16_t));
 
-    *(kingWhiteX) = 4;
-    *(kingWhiteY) = 7;
-    *(kingBlackX) = 4;
-    *(kingBlackY) = 0;
+    // Positions the engine has searched, kept between its moves.
+    struct transpositionTable * table = (computerPlayer != '.') ? createTable(engine.hashMegabytes) : NULL;
+    struct pawnTable * pawns = (computerPlayer != '.') ? createPawnTables(engine.threads) : NULL;
 
-    *(whiteCheck) = PERSISTENT_FALSE;
-    *(blackCheck) = PERSISTENT_FALSE;
+    // What the board highlights, worked out again only when the position or cursor changes.
+    struct highlightCache * highlights = (struct highlightCache *)calloc(1, sizeof(struct highlightCache));
+    clearHighlights(highlights);
 
     // Initialise a game state structure.
     struct gameState state = {
@@ -1803,65 +4482,713 @@ int initialiseGame() {
         currentPlayer,
         lastPlayer,
         turnCount,
-        cursorX,
-        cursorY,
-        selectMode,
-        selectedX,
-        selectedY,
-        selectedPiece,
-        queensideCastleWhite,
-        queensideCastleBlack,
-        kingsideCastleWhite,
-        kingsideCastleBlack,
-        kingWhiteX,
-        kingWhiteY,
-        kingBlackX,
-        kingBlackY,
-        whiteCheck,
-        blackCheck
+        game,
+        redoMoves,
+        0,
+        engine,
+        table,
+        pawns,
+        highlights
     };    
 
-    // The game loop.
+    storeGame(&state);
+    if (fen != NULL) {
+        setGamePosition(&state, fen);
+    }
+
+    // The game is played on the working board, set up from its stored position.
+    resumeGame(&state);
+
+    // The game loop, which returns once the game is over.
 	gameLoop(state);
     
     // Free memory dynamically allocated for the game board at end of game.
-    // This will never be reached, unless an actual checkmate detection system is properly added.
-    // Possibly, one can count possible moves and check if it is zero, but currently the game segfaults with the current implementation.
     free(board);
-    free(selectMode);
-    free(selectedX);
-    free(selectedY);
-    free(queensideCastleWhite);
-    free(queensideCastleBlack);
-    free(kingsideCastleWhite);
-    free(kingsideCastleBlack);
-    free(kingWhiteX);
-    free(kingWhiteY);
-    free(kingBlackX);
-    free(kingBlackY);
-    free(whiteCheck);
-    free(blackCheck);
-}
-
-// Initialise main menu.
-int main() {
-    // Clear the terminal.
-    system("clear");
+    free(redoMoves);
+    freeTable(table);
+    free(pawns);
+    free(highlights);
+    releaseGame(pool, game);
+    freeGamePool(pool);
+
+    return 0;
+}
+
+// Run perft from a position, printing the count below each root move and the overall speed.
+int runPerft(const char* fen, int depth, int threads, int hashMegabytes) {
+    struct chessBoard* board = calloc(1, sizeof(struct chessBoard));
+
+    if (fen != NULL) {
+        if (!loadFen(board, fen)) {
+            fprintf(stderr, "Invalid FEN: %s\n", fen);
+            free(board);
+            return 1;
+        }
+    }
+    else {
+        populateBoard(board);
+    }
+
+    struct perftTable table = {NULL, 0};
+    if (hashMegabytes > 0) {
+        uint64_t size = 1;
+        while (size * 2 * sizeof(struct perftEntry) <= (uint64_t)hashMegabytes << 20) size *= 2;
+        table.entries = calloc(size, sizeof(struct perftEntry));
+        table.mask = size - 1;
+    }
+
+    // Keep only the legal root moves, so each worker has a real subtree to count.
+    struct moveList legal;
+    generateLegalMoves(board, &legal);
+
+    uint64_t counts[MAX_MOVES] = {0};
+    struct perftJob job = {
+        .board = board,
+        .depth = depth,
+        .table = table.entries ? &table : NULL,
+        .moves = legal.moves,
+        .counts = counts,
+        .count = legal.count,
+        .next = 0
+    };
+    pthread_mutex_init(&job.lock, NULL);
+
+    double start = currentTime();
+
+    if (depth > 0) {
+        // The workers share out the moves, so any that started cover for those that couldn't.
+        pthread_t workers[MAX_THREADS];
+        int started = 0;
+        while (started < threads && started < MAX_THREADS && pthread_create(&workers[started], NULL, perftWorker, &job) == 0) started++;
+        if (started == 0) perftWorker(&job);
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+
+    double elapsed = currentTime() - start;
+    pthread_mutex_destroy(&job.lock);
+
+    uint64_t nodes = (depth > 0) ? 0 : 1;
+    for (int i = 0; i < legal.count && depth > 0; i++) {
+        char move[6];
+        moveToString(legal.moves[i], move);
+        printf("%s: %llu\n", move, (unsigned long long)counts[i]);
+        nodes += counts[i];
+    }
+
+    printf("\nNodes searched: %llu\n", (unsigned long long)nodes);
+    printf("Time: %.3f s\n", elapsed);
+    printf("Nodes/second: %.0f\n", (elapsed > 0) ? nodes / elapsed : 0.0);
+
+    free(table.entries);
+    free(board);
+    return 0;
+}
+
+// Positions searched by --bench: the start, the usual perft test positions and a few middlegames.
+const char* benchPositions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq -",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ -",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - -",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq -",
+    "2rq1rk1/pp1bppbp/2np1np1/8/3NP3/1BN1BP2/PPPQ2PP/2KR3R b - -",
+    NULL
+};
+
+// Time limit the bench cuts searches off at, to measure how long after it their moves come back.
+#define BENCH_DEADLINE 0.1
+
+// Games the bench packs into one pool, as many as a server might hold at once.
+#define BENCH_GAMES 100000
+
+// Set the board up as the bench's game of the given number: one of the bench positions with one of its
+// legal moves played, so the games differ from each other.
+void setUpBenchGame(struct chessBoard* board, int number) {
+    int positions = 0;
+    while (benchPositions[positions] != NULL) positions++;
+
+    struct moveList legal;
+    loadFen(board, benchPositions[number % positions]);
+    generateLegalMoves(board, &legal);
+    if (legal.count > 0) makeMove(board, legal.moves[(number / positions) % legal.count]);
+}
+
+// Search every bench position to a fixed depth: on one thread without a transposition table, on one
+// thread with one, and, if more threads are asked for, on all of them sharing one table.
+// Report the nodes and time each took, and the speedup of the threads over one thread.
+// Then search each without a depth limit until a deadline, and report how late the moves came.
+// Last, pack BENCH_GAMES games into a pool and check that each unpacks to the position it was packed from.
+int runBench(struct engineOptions engine) {
+    struct chessBoard* board = calloc(1, sizeof(struct chessBoard));
+    struct pawnTable* pawns = createPawnTables(engine.threads);
+    int runs = (engine.threads > 1) ? 3 : 2;
+    uint64_t totalNodes[3] = {0, 0, 0};
+    double totalTime[3] = {0, 0, 0};
+    uint64_t pawnProbes = 0;
+    uint64_t pawnHits = 0;
+
+    engine.moveTime = 1e9;
+
+    printf("%-4s %12s %9s %12s %9s", "pos", "nodes", "ms", "nodes (tt)", "ms (tt)");
+    if (runs == 3) printf(" %12s %9s %8s", "nodes (smp)", "ms (smp)", "speedup");
+    printf("\n");
+
+    for (int i = 0; benchPositions[i] != NULL; i++) {
+        struct searchResult results[3];
+
+        for (int run = 0; run < runs; run++) {
+            struct engineOptions options = engine;
+            struct transpositionTable* table = (run > 0) ? createTable(engine.hashMegabytes) : NULL;
+            options.threads = (run == 2) ? engine.threads : 1;
+
+            // Every search starts from empty tables, so the runs are compared fairly.
+            clearPawnTables(pawns, engine.threads);
+            loadFen(board, benchPositions[i]);
+            results[run] = searchBestMove(board, table, pawns, options, false, NULL);
+            totalNodes[run] += results[run].nodes;
+            totalTime[run] += results[run].time;
+            pawnProbes += results[run].pawnProbes;
+            pawnHits += results[run].pawnHits;
+            freeTable(table);
+        }
+
+        printf("%-4d %12llu %9.0f %12llu %9.0f", i + 1,
+            (unsigned long long)results[0].nodes, results[0].time * 1000,
+            (unsigned long long)results[1].nodes, results[1].time * 1000);
+        if (runs == 3) {
+            printf(" %12llu %9.0f %7.2fx", (unsigned long long)results[2].nodes, results[2].time * 1000,
+                results[1].time / results[2].time);
+        }
+        printf("\n");
+    }
+
+    // Cut a search of each position off at the deadline, to see how long after it the move comes back.
+    // One that finishes sooner, on a forced mate, says nothing about stopping and is left out.
+    int cutOff = 0;
+    double totalLatency = 0;
+    double worstLatency = 0;
+    for (int i = 0; benchPositions[i] != NULL; i++) {
+        struct engineOptions options = engine;
+        struct transpositionTable* table = createTable(engine.hashMegabytes);
+        options.depth = 0;
+        options.moveTime = BENCH_DEADLINE;
+
+        clearPawnTables(pawns, engine.threads);
+        loadFen(board, benchPositions[i]);
+        struct searchResult result = searchBestMove(board, table, pawns, options, false, NULL);
+        freeTable(table);
+        if (result.time < result.limit) continue;
+
+        double latency = result.time - result.limit;
+        cutOff++;
+        totalLatency += latency;
+        if (latency > worstLatency) worstLatency = latency;
+    }
+
+    printf("\nDepth: %d\n", engine.depth);
+    printf("Search:");
+    for (int i = 0; searchFeatureNames[i] != NULL; i++) {
+        printf(" %s %s%s", searchFeatureNames[i], (engine.features & (1 << i)) ? "on" : "off", searchFeatureNames[i + 1] ? "," : "\n");
+    }
+    printf("Nodes: %llu without table, %llu with table (%.1f%% fewer)\n",
+        (unsigned long long)totalNodes[0], (unsigned long long)totalNodes[1],
+        100.0 * (1.0 - (double)totalNodes[1] / totalNodes[0]));
+    printf("Time: %.3f s without table, %.3f s with table (%.1f%% less)\n",
+        totalTime[0], totalTime[1], 100.0 * (1.0 - totalTime[1] / totalTime[0]));
+    if (pawnProbes > 0) {
+        printf("Pawn table: %.1f%% of %llu lookups found their entry\n", 100.0 * pawnHits / pawnProbes, (unsigned long long)pawnProbes);
+    }
+    if (runs == 3) {
+        printf("Threads: %d, %.3f s to depth against %.3f s on one thread (%.2fx speedup, %.0f nodes/second)\n",
+            engine.threads, totalTime[2], totalTime[1], totalTime[1] / totalTime[2], totalNodes[2] / totalTime[2]);
+    }
+    if (cutOff > 0) {
+        printf("Deadline: %d searches cut off at %.0f ms answered %.2f ms after it on average, %.2f ms at worst\n",
+            cutOff, BENCH_DEADLINE * 1000, totalLatency / cutOff * 1000, worstLatency * 1000);
+    }
+
+    // The unpacked board has to match in every way the search relies on, not just in its FEN.
+    struct gamePool* pool = createGamePool(BENCH_GAMES);
+    struct chessBoard* unpacked = malloc(sizeof(struct chessBoard));
+    int mismatches = 0;
+    if (pool != NULL && unpacked != NULL) {
+        for (int i = 0; i < BENCH_GAMES; i++) {
+            setUpBenchGame(board, i);
+            packPosition(board, &takeGame(pool)->position);
+        }
+        for (int i = 0; i < BENCH_GAMES; i++) {
+            char expected[MAX_FEN_LENGTH];
+            char found[MAX_FEN_LENGTH];
+            setUpBenchGame(board, i);
+            unpackPosition(unpacked, &pool->games[i].position);
+            writeFen(board, expected);
+            writeFen(unpacked, found);
+            if (strcmp(expected, found) != 0 || unpacked->key != board->key || unpacked->pawnKey != board->pawnKey
+                || unpacked->score != board->score || unpacked->phase != board->phase) {
+                mismatches++;
+            }
+        }
+        printf("Games: %d in a pool of %.1f MB (%d bytes each, %d for the position), %d unpacked differently\n",
+            pool->used, (double)pool->capacity * sizeof(struct storedGame) / (1 << 20), (int)sizeof(struct storedGame),
+            (int)sizeof(struct position), mismatches);
+    }
+    else {
+        printf("Games: not enough memory for a pool of %d\n", BENCH_GAMES);
+    }
+
+    freeGamePool(pool);
+    free(unpacked);
+    free(pawns);
+    free(board);
+    return (mismatches > 0) ? 1 : 0;
+}
+
+// A search started by the UCI "go" command. It runs on its own thread, so "stop" and "isready"
+// are still read while it thinks.
+struct uciSearch
+{
+    struct chessBoard* board;
+    struct transpositionTable* table;
+    struct pawnTable* pawns; // One per engine thread.
+    struct engineOptions options;
+    bool infinite;
+    bool running;
+    bool stop;
+    double stopTime; // When "stop" came, written before the stop flag is raised.
+    pthread_t thread;
+};
+
+// Search the position and answer with the best move. An infinite search holds its answer until it is stopped.
+void* uciSearchThread(void* argument) {
+    struct uciSearch* search = argument;
+    double start = currentTime();
+    struct searchResult result = searchBestMove(search->board, search->table, search->pawns, search->options, true, &search->stop);
+
+    while (search->infinite && !stopFlag(&search->stop)) {
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+    }
+
+    // Say how long after "stop", or after the hard time limit, the answer goes out.
+    double now = currentTime();
+    if (stopFlag(&search->stop)) {
+        printf("info string answered %.1f ms after stop\n", (now - search->stopTime) * 1000);
+    }
+    else if (result.limit > 0 && now >= start + result.limit) {
+        printf("info string answered %.1f ms after the time limit\n", (now - start - result.limit) * 1000);
+    }
+
+    char move[6] = "0000";
+    if (result.move) moveToString(result.move, move);
+    printf("bestmove %s\n", move);
+    fflush(stdout);
+    return NULL;
+}
+
+// Wait for the running search, if there is one, to give its answer. Searches with a budget are
+// left to finish, so commands piped in ahead of time don't cut them short, unless told to stop now.
+void finishUciSearch(struct uciSearch* search, bool stopNow) {
+    if (!search->running) return;
+    if (stopNow || search->infinite) {
+        search->stopTime = currentTime();
+        raiseStopFlag(&search->stop);
+    }
+    pthread_join(search->thread, NULL);
+    search->running = false;
+}
+
+// Set up the board from "position [startpos | fen <fen>] [moves <move>...]".
+void uciPosition(struct chessBoard* board, char* line) {
+    char* fen = strstr(line, "fen ");
+    char* moves = strstr(line, "moves");
+
+    if (fen != NULL && (moves == NULL || fen < moves)) {
+        // A FEN that doesn't load leaves the board half set up, so go back to the start, without the moves meant
+        // for the position it should have been.
+        if (!loadFen(board, fen + 4)) {
+            printf("info string invalid FEN, using the start position\n");
+            memset(board, 0, sizeof(struct chessBoard));
+            populateBoard(board);
+            return;
+        }
+    }
+    else {
+        memset(board, 0, sizeof(struct chessBoard));
+        populateBoard(board);
+    }
+
+    if (moves == NULL) return;
+
+    // Leave room on the board's move stack for the search. The moves after one that can't be played
+    // are dropped too, since they were meant for a different position.
+    for (char* token = strtok(moves + 5, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+        uint16_t move = parseMove(board, token);
+        if (move == 0) {
+            printf("info string illegal or unreadable move %s, ignoring it and the moves after it\n", token);
+            break;
+        }
+        if (board->historyCount >= MAX_GAME_PLY - MAX_SEARCH_PLY) {
+            printf("info string too many moves, ignoring %s and the moves after it\n", token);
+            break;
+        }
+        makeMove(board, move);
+    }
+}
+
+// Read the value after a word of a "go" command, or return the fallback if the word isn't there.
+int uciValue(const char* line, const char* name, int fallback) {
+    const char* found = strstr(line, name);
+    return (found != NULL) ? atoi(found + strlen(name)) : fallback;
+}
+
+// Read the value of a spin option, kept within the range advertised for it.
+int uciSpinValue(const char* line, int fallback, int min, int max) {
+    int value = uciValue(line, "value ", fallback);
+    return (value < min) ? min : ((value > max) ? max : value);
+}
+
+// Start a search from "go [depth <n>] [movetime <ms>] [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>]
+// [movestogo <n>] [infinite]".
+void uciGo(struct uciSearch* search, struct engineOptions engine, char* line) {
+    int us = search->board->side;
+    int remaining = uciValue(line, (us == WHITE) ? "wtime " : "btime ", -1);
+
+    search->options = engine;
+    search->options.depth = uciValue(line, "depth ", 0);
+    search->options.moveTime = uciValue(line, "movetime ", 0) / 1000.0;
+    search->infinite = (strstr(line, "infinite") != NULL);
+
+    // On a clock, the search shares out the time itself. A clock that has run right down still gets a moment.
+    if (remaining >= 0) {
+        search->options.clock = ((remaining > 1) ? remaining : 1) / 1000.0;
+        search->options.increment = uciValue(line, (us == WHITE) ? "winc " : "binc ", 0) / 1000.0;
+        search->options.movesToGo = uciValue(line, "movestogo ", 0);
+    }
+    if (search->infinite) {
+        search->options.depth = 0;
+        search->options.moveTime = 0;
+        search->options.clock = 0;
+    }
+    else if (search->options.depth == 0 && search->options.moveTime == 0 && search->options.clock == 0) {
+        search->options.depth = engine.depth;
+        search->options.moveTime = engine.moveTime;
+    }
+
+    // Without a thread of its own, the search answers before the next command is read,
+    // so one that would wait for "stop" keeps to the usual limits instead.
+    search->stop = false;
+    search->running = pthread_create(&search->thread, NULL, uciSearchThread, search) == 0;
+    if (!search->running) {
+        if (search->infinite) {
+            search->infinite = false;
+            search->options.depth = engine.depth;
+            search->options.moveTime = engine.moveTime;
+        }
+        uciSearchThread(search);
+    }
+}
+
+// Talk the Universal Chess Interface on stdin and stdout, without the terminal or the board display.
+int runUci(struct engineOptions engine) {
+    struct chessBoard* board = calloc(1, sizeof(struct chessBoard));
+    struct uciSearch search = {
+        .board = board,
+        .table = createTable(engine.hashMegabytes),
+        .pawns = createPawnTables(engine.threads),
+        .options = engine,
+        .infinite = false,
+        .running = false,
+        .stop = false,
+        .stopTime = 0
+    };
+    char* line = NULL;
+    size_t capacity = 0;
+
+    populateBoard(board);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    while (getline(&line, &capacity, stdin) >= 0) {
+        if (strncmp(line, "uci", 3) == 0 && (line[3] == '\n' || line[3] == '\0')) {
+            printf("id name C99 Chess\n");
+            printf("id author ArtisanLRO\n");
+            printf("option name Hash type spin default %d min 1 max %d\n", engine.hashMegabytes, MAX_HASH_MEGABYTES);
+            printf("option name Threads type spin default %d min 1 max %d\n", engine.threads, MAX_THREADS);
+            printf("option name EvalFile type string default <empty>\n");
+            for (int i = 0; searchFeatureNames[i] != NULL; i++) {
+                printf("option name %s type check default %s\n", searchFeatureNames[i], (engine.features & (1 << i)) ? "true" : "false");
+            }
+            printf("uciok\n");
+        }
+        else if (strncmp(line, "isready", 7) == 0) {
+            printf("readyok\n");
+        }
+        else if (strncmp(line, "setoption", 9) == 0) {
+            finishUciSearch(&search, false);
+            if (strstr(line, "name Hash") != NULL) {
+                // Without the memory for the new size, the old table stays.
+                int megabytes = uciSpinValue(line, engine.hashMegabytes, 1, MAX_HASH_MEGABYTES);
+                struct transpositionTable* table = createTable(megabytes);
+                if (table != NULL) {
+                    freeTable(search.table);
+                    search.table = table;
+                    engine.hashMegabytes = megabytes;
+                }
+                else {
+                    printf("info string not enough memory for a %d MB hash, keeping the old one\n", megabytes);
+                }
+            }
+            else if (strstr(line, "name Threads") != NULL) {
+                engine.threads = uciSpinValue(line, engine.threads, 1, MAX_THREADS);
+                free(search.pawns);
+                search.pawns = createPawnTables(engine.threads);
+            }
+            else if (strstr(line, "name EvalFile") != NULL) {
+                // An empty value or <empty> goes back to the piece-square evaluation.
+                char* path = strstr(line, "value ");
+                if (path != NULL) path = strtok(path + 6, "\r\n");
+                if (path == NULL || strcmp(path, "<empty>") == 0) unloadNetwork();
+                else if (!loadNetwork(path)) printf("info string could not load %s\n", path);
+                // Scores stored under the old evaluation no longer hold.
+                clearTable(search.table);
+            }
+            else {
+                // The search techniques are check options named after them.
+                for (int i = 0; searchFeatureNames[i] != NULL; i++) {
+                    char name[32];
+                    snprintf(name, sizeof(name), "name %s ", searchFeatureNames[i]);
+                    if (strstr(line, name) == NULL) continue;
+                    if (strstr(line, "value true") != NULL) engine.features |= 1 << i;
+                    else engine.features &= ~(1 << i);
+                }
+            }
+        }
+        else if (strncmp(line, "ucinewgame", 10) == 0) {
+            finishUciSearch(&search, false);
+            clearTable(search.table);
+            clearPawnTables(search.pawns, engine.threads);
+        }
+        else if (strncmp(line, "position", 8) == 0) {
+            finishUciSearch(&search, false);
+            uciPosition(board, line);
+        }
+        else if (strncmp(line, "go", 2) == 0) {
+            finishUciSearch(&search, false);
+            uciGo(&search, engine, line);
+        }
+        else if (strncmp(line, "stop", 4) == 0) {
+            finishUciSearch(&search, true);
+        }
+        else if (strncmp(line, "quit", 4) == 0) {
+            finishUciSearch(&search, true);
+            break;
+        }
+    }
+
+    // At the end of the input, a search with a budget still gets to answer.
+    finishUciSearch(&search, false);
+    freeTable(search.table);
+    free(search.pawns);
+    free(line);
+    free(board);
+    return 0;
+}
+
+// Print the static evaluation of a position and what goes into it.
+int runEval(const char* fen) {
+    struct chessBoard* board = calloc(1, sizeof(struct chessBoard));
+
+    if (fen == NULL || !loadFen(board, fen)) {
+        fprintf(stderr, "Invalid FEN: %s\n", fen ? fen : "");
+        free(board);
+        return 1;
+    }
+
+    struct pawnEntry pawns;
+    evaluatePawns(board, &pawns);
+    int pawnScore = pawns.score + pawnSurroundingsScore(board, &pawns);
+    int score = evaluateWhite(board, NULL);
+    printf("Piece-square: %d middlegame, %d endgame\n", MG_SCORE(board->score), EG_SCORE(board->score));
+    printf("Pawns: %d middlegame, %d endgame\n", MG_SCORE(pawnScore), EG_SCORE(pawnScore));
+    printf("Passed pawns:");
+    for (uint64_t passed = pawns.passed[WHITE] | pawns.passed[BLACK]; passed; passed &= passed - 1) {
+        int square = __builtin_ctzll(passed);
+        printf(" %c%d", 'a' + square % BOARD_SIZE, BOARD_SIZE - square / BOARD_SIZE);
+    }
+    printf("%s\n", (pawns.passed[WHITE] | pawns.passed[BLACK]) ? "" : " none");
+    printf("Phase: %d/%d\n", (board->phase < MAX_PHASE) ? board->phase : MAX_PHASE, MAX_PHASE);
+    printf("Evaluation: %d cp for White, %d cp for the side to move\n", score, (board->side == WHITE) ? score : -score);
+
+    if (network != NULL) {
+        // Time the layers after the accumulators, which is all a search pays for most evaluations.
+        const int repeats = 1000000;
+        int networkScore = evaluate(board, NULL);
+        double start = currentTime();
+        for (int i = 0; i < repeats; i++) evaluateNetwork(board);
+        double elapsed = currentTime() - start;
+        printf("Network: %d cp for the side to move (%s, %.0f evaluations a second)\n", networkScore, nnueKernels.name,
+               repeats / ((elapsed > 0) ? elapsed : 1e-9));
+    }
+
+    free(board);
+    return 0;
+}
+
+// Show the command line options.
+void printUsage(const char* program) {
+    fprintf(stderr, "usage: %s [--perft <depth> [--fen <fen>] [--threads <n>] [--hash <MB>]]\n", program);
+    fprintf(stderr, "       %s --uci [--hash <MB>] [--threads <n>] [--pin] [--nnue <file>] [--disable <techniques>]\n", program);
+    fprintf(stderr, "       %s --eval <fen> [--nnue <file>]\n", program);
+    fprintf(stderr, "       %s --bench [--depth <plies>] [--hash <MB>] [--threads <n>] [--pin] [--nnue <file>] [--disable <techniques>]\n", program);
+    fprintf(stderr, "       %s [--fen <fen>] [--depth <plies>] [--movetime <ms>] [--hash <MB>] [--threads <n>] [--pin] [--nnue <file>]\n"
+                    "         [--disable <techniques>]\n", program);
+}
+
+// Initialise main menu, or run one of the non-interactive modes.
+int main(int argc, char** argv) {
+    // Build the attack lookup tables used by every rule check.
+    initAttackTables();
+    initZobrist();
+    initReductions();
+
+    const char* fen = NULL;
+    const char* evalFen = NULL;
+    int perftDepth = -1;
+    int threads = 1;
+    int hashMegabytes = -1;
+    int searchDepth = 0;
+    bool bench = false;
+    bool uci = false;
+    bool pinThreads = false;
+    int moveTime = 500;
+    int features = SEARCH_ALL;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+
+        if (strcmp(argv[i], "--perft") == 0 && hasValue) {
+            perftDepth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fen") == 0 && hasValue) {
+            fen = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            threads = atoi(argv[++i]);
+            if (threads < 1) threads = 1;
+            if (threads > MAX_THREADS) threads = MAX_THREADS;
+        }
+        else if (strcmp(argv[i], "--hash") == 0 && hasValue) {
+            hashMegabytes = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pin") == 0) {
+            pinThreads = true;
+        }
+        else if (strcmp(argv[i], "--nnue") == 0 && hasValue) {
+            if (!loadNetwork(argv[++i])) return 1;
+        }
+        else if (strcmp(argv[i], "--eval") == 0 && hasValue) {
+            evalFen = argv[++i];
+        }
+        else if (strcmp(argv[i], "--uci") == 0) {
+            uci = true;
+        }
+        else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && hasValue) {
+            searchDepth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--movetime") == 0 && hasValue) {
+            moveTime = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--disable") == 0 && hasValue) {
+            features = disableSearchFeatures(features, argv[++i]);
+            if (features < 0) {
+                fprintf(stderr, "Unknown search technique in %s, expected all or any of PVS, Aspiration, NullMove, LMR, Futility\n", argv[i]);
+                return 1;
+            }
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (evalFen != NULL) {
+        return runEval(evalFen);
+    }
+    if (perftDepth >= 0) {
+        // Perft only caches counts when asked to, the engine always has a table.
+        return runPerft(fen, perftDepth, threads, (hashMegabytes > 0) ? hashMegabytes : 0);
+    }
+
+    struct engineOptions engine = {
+        .depth = searchDepth,
+        .moveTime = moveTime / 1000.0,
+        .hashMegabytes = (hashMegabytes > 0) ? hashMegabytes : 16,
+        .threads = threads,
+        .pinThreads = pinThreads,
+        .features = features,
+        .clock = 0,
+        .increment = 0,
+        .movesToGo = 0
+    };
+
+    // Check a FEN for the game before the terminal is taken over. Without the memory to check it here,
+    // setGamePosition still turns an invalid one down.
+    if (fen != NULL) {
+        struct chessBoard* board = malloc(sizeof(struct chessBoard));
+        bool valid = (board == NULL) || loadFen(board, fen);
+        free(board);
+        if (!valid) {
+            fprintf(stderr, "Invalid FEN: %s\n", fen);
+            return 1;
+        }
+    }
+
+    if (uci) {
+        return runUci(engine);
+    }
+    if (bench) {
+        if (engine.depth <= 0) engine.depth = 6;
+        return runBench(engine);
+    }
+
+    // Keys are read unbuffered and unechoed from here until the program ends.
+    enableRawMode();
+
+    // Draw a fresh frame; only what changed since the last one is sent to the terminal.
+    beginFrame();
 
     // Print the header.
-    printf("\n\e[0;107m                                ");
-    printf("\n\e[0;100m           C99 CHESS            ");
-    printf("\n\e[0;100m         by ArtisanLRO          ");
-    printf("\n\e[0;107m                                ");
+    screenPrintf("\n\e[0;107m                                ");
+    screenPrintf("\n\e[0;100m           C99 CHESS            ");
+    screenPrintf("\n\e[0;100m         by ArtisanLRO          ");
+    screenPrintf("\n\e[0;107m                                ");
     
     // Print a dummy board.
     renderDummyBoard();
 
-    printf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");
-    printf("\n\e[0m     PRESS ANY KEY TO START");
-    printf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");\
-    
-    getch();
+    screenPrintf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");
+    screenPrintf("\n\e[0m     1 - TWO PLAYERS");
+    screenPrintf("\n\e[0m     2 - PLAY WHITE VS COMPUTER");
+    screenPrintf("\n\e[0m     3 - PLAY BLACK VS COMPUTER");
+    screenPrintf("\n\e[0;100m■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■■\e[0m");
+    flushScreen();
+
+    // Pick who the engine plays for, if anyone.
+    char computerPlayer = 0;
+    while (computerPlayer == 0) {
+        switch(getch()) {
+            case '1': computerPlayer = '.'; break;
+            case '2': computerPlayer = PLAYER_2; break;
+            case '3': computerPlayer = PLAYER_1; break;
+            default: ;
+        }
+    }
 
-    initialiseGame();
+    initialiseGame(computerPlayer, engine, fen);
 }
\ No newline at end of file